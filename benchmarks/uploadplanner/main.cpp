@@ -0,0 +1,287 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+// Replays dirty region traces of typical updates through each upload
+// planner and reports what the uploads cost. With an OpenGL context the
+// planned rectangles are uploaded to a texture the way the backing store
+// does, so the cost planner calibrates itself as it would on the device.
+// Without one only the planning is timed.
+
+#include "qeglfsuploadplanner.h"
+#include "qeglfstextureuploader.h"
+#include "qeglfstilemap.h"
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QStringList>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QImage>
+#include <QtGui/QOffscreenSurface>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLFunctions>
+#include <QtGui/QRegion>
+
+#include <stdio.h>
+
+struct Trace
+{
+    const char *name;
+    QVector<QRegion> frames;
+};
+
+struct Result
+{
+    Result() : bytes(0), calls(0), nsecs(0) {}
+
+    qint64 bytes;
+    qint64 calls;
+    qint64 nsecs;
+};
+
+// A line of text filling up glyph by glyph with the cursor after it, and
+// a clock in the status bar that changes once a second
+static Trace typingTrace(const QSize &size, int frames)
+{
+    enum { GlyphWidth = 18, LineHeight = 40, CursorWidth = 2, Margin = 16 };
+
+    Trace trace;
+    trace.name = "typing";
+
+    const int firstLine = size.height() / 3;
+    int x = Margin;
+    int y = firstLine;
+    for (int i = 0; i < frames; ++i) {
+        QRegion dirty(x, y, GlyphWidth + CursorWidth, LineHeight);
+        x += GlyphWidth;
+        if (x + GlyphWidth + CursorWidth > size.width() - Margin) {
+            x = Margin;
+            y += LineHeight;
+            if (y + LineHeight > size.height())
+                y = firstLine;
+            dirty += QRect(x, y, CursorWidth, LineHeight);
+        }
+        if (i % 60 == 0)
+            dirty += QRect(size.width() - 160, 0, 160, 36);
+        trace.frames.append(dirty);
+    }
+    return trace;
+}
+
+// A list scrolling under a fixed header and toolbar, with the header
+// shadow repainted while the list moves
+static Trace listScrollTrace(const QSize &size, int frames)
+{
+    const int header = size.height() / 10;
+    const int toolbar = size.height() / 12;
+
+    Trace trace;
+    trace.name = "list-scroll";
+    for (int i = 0; i < frames; ++i) {
+        QRegion dirty(0, header, size.width(), size.height() - header - toolbar);
+        dirty += QRect(0, header - 8, size.width(), 8);
+        trace.frames.append(dirty);
+    }
+    return trace;
+}
+
+static Trace fullscreenTrace(const QSize &size, int frames)
+{
+    Trace trace;
+    trace.name = "fullscreen";
+    for (int i = 0; i < frames; ++i)
+        trace.frames.append(QRegion(0, 0, size.width(), size.height()));
+    return trace;
+}
+
+// Busy indicators spread over a grid of icons, a different few of them
+// each frame, which gives the planners many small rectangles
+static Trace iconsTrace(const QSize &size, int frames)
+{
+    enum { Columns = 6, Icon = 48 };
+
+    const int cell = size.width() / Columns;
+    const int rows = size.height() / cell;
+
+    Trace trace;
+    trace.name = "icons";
+    for (int i = 0; i < frames; ++i) {
+        QRegion dirty;
+        for (int row = 0; row < rows; ++row) {
+            for (int column = 0; column < Columns; ++column) {
+                if ((row * Columns + column + i) % 3 == 0)
+                    dirty += QRect(column * cell + (cell - Icon) / 2, row * cell + (cell - Icon) / 2, Icon, Icon);
+            }
+        }
+        trace.frames.append(dirty);
+    }
+    return trace;
+}
+
+class TextureTarget
+{
+public:
+    TextureTarget() : m_gl(0), m_texture(0) {}
+
+    ~TextureTarget()
+    {
+        if (m_texture)
+            m_gl->glDeleteTextures(1, &m_texture);
+    }
+
+    bool create(const QSize &size)
+    {
+        m_surface.create();
+        if (!m_context.create() || !m_context.makeCurrent(&m_surface))
+            return false;
+
+        m_gl = m_context.functions();
+        m_gl->glGenTextures(1, &m_texture);
+        m_gl->glBindTexture(GL_TEXTURE_2D, m_texture);
+        m_gl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.width(), size.height(), 0,
+                           GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        return true;
+    }
+
+    bool isValid() const { return m_texture != 0; }
+
+    // Same as the backing store without GL_UNPACK_ROW_LENGTH, partial
+    // rows go through its staging copy
+    void upload(const QImage &image, const QRect &rect)
+    {
+        m_gl->glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(), rect.width(), rect.height(),
+                              GL_RGBA, GL_UNSIGNED_BYTE,
+                              QEglFSTextureUploader::unpackRect(image, rect, 4, &m_staging));
+    }
+
+    void finish()
+    {
+        if (m_gl)
+            m_gl->glFinish();
+    }
+
+private:
+    QOffscreenSurface m_surface;
+    QOpenGLContext m_context;
+    QOpenGLFunctions *m_gl;
+    GLuint m_texture;
+    QByteArray m_staging;
+};
+
+static Result replay(const Trace &trace, const QByteArray &strategy, const QImage &image, TextureTarget *target)
+{
+    qputenv("QPA_HWC_UPLOAD_PLANNER", strategy);
+    QEglFSUploadPlanner *planner = QEglFSUploadPlanner::create();
+
+    QEglFSTileMap tiles;
+    tiles.resize(image.size());
+    tiles.clear();
+
+    Result result;
+    QElapsedTimer wall;
+    wall.start();
+    foreach (const QRegion &dirty, trace.frames) {
+        tiles.markDirty(dirty);
+        const QVector<QRect> rects = planner->plan(tiles.dirtyRects(), image.size(), 4);
+        tiles.clear();
+
+        foreach (const QRect &rect, rects) {
+            const int bytes = rect.width() * rect.height() * 4;
+            if (target->isValid()) {
+                QElapsedTimer timer;
+                timer.start();
+                target->upload(image, rect);
+                planner->uploaded(bytes, timer.nsecsElapsed());
+            }
+            result.bytes += bytes;
+            ++result.calls;
+        }
+        target->finish();
+    }
+    result.nsecs = wall.nsecsElapsed();
+
+    delete planner;
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays dirty region traces through the upload planners");
+    parser.addHelpOption();
+    QCommandLineOption framesOption("frames", "Frames per trace.", "count", "600");
+    QCommandLineOption sizeOption("size", "Window size.", "WxH", "1080x1920");
+    parser.addOption(framesOption);
+    parser.addOption(sizeOption);
+    parser.process(app);
+
+    const int frames = parser.value(framesOption).toInt();
+    const QStringList dimensions = parser.value(sizeOption).split('x');
+    const QSize size = dimensions.size() == 2
+        ? QSize(dimensions.at(0).toInt(), dimensions.at(1).toInt()) : QSize();
+    if (frames <= 0 || size.isEmpty()) {
+        fprintf(stderr, "invalid --frames or --size\n");
+        return 1;
+    }
+
+    QImage image(size, QImage::Format_RGBA8888);
+    image.fill(Qt::darkCyan);
+
+    TextureTarget target;
+    if (!target.create(size))
+        fprintf(stderr, "no OpenGL context, nothing is uploaded and wall time covers planning only\n");
+
+    QVector<Trace> traces;
+    traces << typingTrace(size, frames) << listScrollTrace(size, frames)
+           << fullscreenTrace(size, frames) << iconsTrace(size, frames);
+
+    const char *strategies[] = { "cost", "tiles", "full" };
+
+    printf("%-12s %-6s %14s %10s %10s\n", "trace", "plan", "MiB uploaded", "GL calls", "wall ms");
+    foreach (const Trace &trace, traces) {
+        for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); ++i) {
+            const Result result = replay(trace, strategies[i], image, &target);
+            printf("%-12s %-6s %14.1f %10lld %10.1f\n", trace.name, strategies[i],
+                   result.bytes / (1024.0 * 1024.0), (long long)result.calls, result.nsecs / 1e6);
+        }
+    }
+
+    return 0;
+}
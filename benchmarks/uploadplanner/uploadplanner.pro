@@ -0,0 +1,19 @@
+TARGET = uploadplanner-benchmark
+TEMPLATE = app
+
+QT += gui
+CONFIG += console
+CONFIG -= app_bundle
+
+PLUGIN_DIR = $$PWD/../../hwcomposer
+INCLUDEPATH += $$PLUGIN_DIR
+
+SOURCES += main.cpp \
+           $$PLUGIN_DIR/qeglfsuploadplanner.cpp \
+           $$PLUGIN_DIR/qeglfstextureuploader.cpp \
+           $$PLUGIN_DIR/qeglfstilemap.cpp
+
+HEADERS += $$PLUGIN_DIR/qeglfsuploadplanner.h \
+           $$PLUGIN_DIR/qeglfstextureuploader.h \
+           $$PLUGIN_DIR/qeglfsbufferpool.h \
+           $$PLUGIN_DIR/qeglfstilemap.h
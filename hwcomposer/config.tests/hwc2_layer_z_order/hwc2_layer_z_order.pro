@@ -0,0 +1,8 @@
+TEMPLATE = app
+
+CONFIG += link_pkgconfig
+PKGCONFIG += android-headers libhwc2
+
+TARGET = hwc2_layer_z_order
+
+SOURCES += main.cpp
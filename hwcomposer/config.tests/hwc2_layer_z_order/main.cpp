@@ -0,0 +1,7 @@
+#include <hybris/hwc2/hwc2_compatibility_layer.h>
+
+int main()
+{
+    hwc2_compat_layer_set_z_order(0, 0);
+    return 0;
+}
@@ -0,0 +1,8 @@
+TEMPLATE = app
+
+CONFIG += link_pkgconfig
+PKGCONFIG += android-headers libhwc2
+
+TARGET = hwc2_surface_damage
+
+SOURCES += main.cpp
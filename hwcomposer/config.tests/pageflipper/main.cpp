@@ -0,0 +1,7 @@
+#include <qpa/qplatformscreenpageflipper.h>
+
+int main()
+{
+    QPlatformScreenPageFlipper *flipper = 0;
+    return flipper ? 1 : 0;
+}
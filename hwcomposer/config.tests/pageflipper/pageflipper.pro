@@ -0,0 +1,7 @@
+TEMPLATE = app
+
+QT += gui-private
+
+TARGET = pageflipper
+
+SOURCES += main.cpp
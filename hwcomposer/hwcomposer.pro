@@ -16,6 +16,9 @@ HEADERS += hwcomposer_context.h
 SOURCES += hwcomposer_screeninfo.cpp
 HEADERS += hwcomposer_screeninfo.h
 
+SOURCES += hwcomposer_startup.cpp
+HEADERS += hwcomposer_startup.h
+
 SOURCES += hwcomposer_backend.cpp
 HEADERS += hwcomposer_backend.h
 
@@ -28,6 +31,24 @@ HEADERS += hwcomposer_backend_v10.h
 SOURCES += hwcomposer_backend_v11.cpp
 HEADERS += hwcomposer_backend_v11.h
 
+SOURCES += hwcomposer_frame_scheduler.cpp
+HEADERS += hwcomposer_frame_scheduler.h
+
+SOURCES += hwcomposer_vsync_source.cpp
+HEADERS += hwcomposer_vsync_source.h
+
+SOURCES += hwcomposer_present_thread.cpp
+HEADERS += hwcomposer_present_thread.h
+
+SOURCES += hwcomposer_fence_policy.cpp
+HEADERS += hwcomposer_fence_policy.h
+
+SOURCES += hwcomposer_stats.cpp
+HEADERS += hwcomposer_stats.h
+
+SOURCES += hwcomposer_trace.cpp
+HEADERS += hwcomposer_trace.h
+
 HEADERS += qsystrace_selector.h
 
 versionAtLeast(QT_MINOR_VERSION, 8) {
@@ -63,6 +84,9 @@ packagesExist(hwcomposer-egl) {
 
     PKGCONFIG += hwcomposer-egl libsync
     DEFINES += HWC_PLUGIN_HAVE_HWCOMPOSER1_API
+
+    SOURCES += qeglfsgrallocbackingstore.cpp
+    HEADERS += qeglfsgrallocbackingstore.h
 }
 
 qtCompileTest(hwcomposer2) {
@@ -70,6 +94,20 @@ qtCompileTest(hwcomposer2) {
     DEFINES += HWC_PLUGIN_HAVE_HWCOMPOSER2_API
     SOURCES += hwcomposer_backend_v20.cpp
     HEADERS += hwcomposer_backend_v20.h
+
+    qtCompileTest(hwc2_layer_z_order) {
+        DEFINES += HWC_PLUGIN_HAVE_HWC2_LAYER_Z_ORDER
+    }
+
+    qtCompileTest(hwc2_surface_damage) {
+        DEFINES += HWC_PLUGIN_HAVE_HWC2_SURFACE_DAMAGE
+    }
+}
+
+qtCompileTest(pageflipper) {
+    DEFINES += HWC_PLUGIN_HAVE_PAGE_FLIPPER
+    SOURCES += qeglfspageflipper.cpp
+    HEADERS += qeglfspageflipper.h
 }
 
 # Avoid X11 header collision
@@ -78,12 +116,23 @@ DEFINES += MESA_EGL_NO_X11_HEADERS
 SOURCES +=  $$PWD/qeglfsintegration.cpp \
             $$PWD/qeglfswindow.cpp \
             $$PWD/qeglfsbackingstore.cpp \
+            $$PWD/qeglfstextureuploader.cpp \
+            $$PWD/qeglfstilemap.cpp \
+            $$PWD/qeglfsuploadplanner.cpp \
+            $$PWD/qeglfsblitter.cpp \
+            $$PWD/qeglfsrenderthread.cpp \
             $$PWD/qeglfsscreen.cpp \
             $$PWD/qeglfscontext.cpp
 
 HEADERS +=  $$PWD/qeglfsintegration.h \
             $$PWD/qeglfswindow.h \
             $$PWD/qeglfsbackingstore.h \
+            $$PWD/qeglfstextureuploader.h \
+            $$PWD/qeglfstilemap.h \
+            $$PWD/qeglfsuploadplanner.h \
+            $$PWD/qeglfsbufferpool.h \
+            $$PWD/qeglfsblitter.h \
+            $$PWD/qeglfsrenderthread.h \
             $$PWD/qeglfsscreen.h \
             $$PWD/qeglfscontext.h
 
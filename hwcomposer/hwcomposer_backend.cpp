@@ -40,6 +40,9 @@
 ****************************************************************************/
 
 #include <dlfcn.h>
+#include <string.h>
+
+#include <QtCore/QVarLengthArray>
 
 #include "hwcomposer_backend.h"
 #ifdef HWC_DEVICE_API_VERSION_0_1
@@ -70,20 +73,22 @@ HwComposerBackend::~HwComposerBackend()
     // XXX: Close/free hwc_module?
 }
 
-HwComposerBackend *
-HwComposerBackend::create()
+void
+HwComposerBackend::openFramebufferFirst()
 {
-    hw_module_t *hwc_module = NULL;
-    hw_device_t *hwc_device = NULL;
-    void *libminisf;
-    void (*startMiniSurfaceFlinger)(void) = NULL;
-
     // Some implementations insist on having the framebuffer module opened before loading
     // the hardware composer one. Therefor we rely on using the fbdev HYBRIS_EGLPLATFORM
     // here and use eglGetDisplay to initialize it.
     if (qEnvironmentVariableIsEmpty("QT_QPA_NO_FRAMEBUFFER_FIRST")) {
 	    eglGetDisplay(EGL_DEFAULT_DISPLAY);
     }
+}
+
+void *
+HwComposerBackend::startMiniSurfaceFlinger()
+{
+    void *libminisf;
+    void (*startMiniSurfaceFlinger)(void) = NULL;
 
     // A reason for calling this method here is to initialize the binder
     // thread pool such that services started from for example the
@@ -103,6 +108,15 @@ HwComposerBackend::create()
 	fprintf(stderr, "libminisf is incompatible or missing. Can not possibly start the SurfaceFlinger service. If you're experiencing troubles with media try updating droidmedia (and/or this plugin).");
     }
 
+    return libminisf;
+}
+
+void
+HwComposerBackend::openDevice(hw_module_t **module, hw_device_t **device)
+{
+    hw_module_t *hwc_module = NULL;
+    hw_device_t *hwc_device = NULL;
+
     // Open hardware composer
     HWC_PLUGIN_ASSERT_ZERO(hw_get_module(HWC_HARDWARE_MODULE_ID, (const hw_module_t **)(&hwc_module)));
 
@@ -125,6 +139,15 @@ HwComposerBackend::create()
     fprintf(stderr, " * Module: %p\n", hwc_device->module);
     fprintf(stderr, "== hwcomposer device ==\n");
 
+    *module = hwc_module;
+    *device = hwc_device;
+}
+
+HwComposerBackend *
+HwComposerBackend::create(hw_module_t *hwc_module, hw_device_t *hwc_device, void *libminisf)
+{
+    uint32_t version = interpreted_version(hwc_device);
+
 #ifdef HWC_DEVICE_API_VERSION_0_1
     // Special-case for old hw adaptations that have the version encoded in
     // legacy format, we have to check hwc_device->version directly, because
@@ -189,3 +212,41 @@ HwComposerBackend::destroy(HwComposerBackend *backend)
 {
     delete backend;
 }
+
+typedef EGLBoolean (*SwapBuffersWithDamage)(EGLDisplay dpy, EGLSurface surface, EGLint *rects, EGLint n_rects);
+
+static SwapBuffersWithDamage resolveSwapBuffersWithDamage(EGLDisplay display)
+{
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions)
+        return NULL;
+
+    if (strstr(extensions, "EGL_KHR_swap_buffers_with_damage"))
+        return (SwapBuffersWithDamage) eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    if (strstr(extensions, "EGL_EXT_swap_buffers_with_damage"))
+        return (SwapBuffersWithDamage) eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+    return NULL;
+}
+
+void
+HwComposerBackend::swapBuffersWithDamage(EGLDisplay display, EGLSurface surface, const QRegion &damage)
+{
+    static const SwapBuffersWithDamage swapWithDamage = resolveSwapBuffersWithDamage(display);
+
+    EGLint height = 0;
+    if (damage.isEmpty() || !swapWithDamage || !eglQuerySurface(display, surface, EGL_HEIGHT, &height)) {
+        eglSwapBuffers(display, surface);
+        return;
+    }
+
+    // EGL rectangles have their origin at the bottom left
+    QVarLengthArray<EGLint, 16> rects;
+    foreach (const QRect &rect, damage.rects()) {
+        rects.append(rect.x());
+        rects.append(height - rect.y() - rect.height());
+        rects.append(rect.width());
+        rects.append(rect.height());
+    }
+
+    swapWithDamage(display, surface, rects.data(), rects.size() / 4);
+}
@@ -54,8 +54,25 @@
 #include <EGL/eglext.h>
 
 #include <qdebug.h>
+#include <QtCore/QRect>
+#include <QtGui/QRegion>
 
 class QEglFSWindow;
+class HwComposerDisplayListener;
+struct ANativeWindowBuffer;
+
+// Placement of a window that is composed by the display hardware on top of
+// the primary window. Higher z is closer to the viewer, the primary window
+// is at 0 and a direct scanout buffer at 1.
+struct HwComposerLayerState
+{
+    HwComposerLayerState() : opacity(1.0), z(2), visible(false) {}
+
+    QRect geometry;
+    qreal opacity;
+    int z;
+    bool visible;
+};
 
 // Evaluate "x", if it doesn't return zero, print a warning
 #define HWC_PLUGIN_EXPECT_ZERO(x) \
@@ -98,26 +115,80 @@ inline static uint32_t interpreted_version(hw_device_t *hwc_device)
 
 class HwComposerBackend {
 public:
+    // Steps of opening the hwcomposer, see HwComposerStartup for their order.
+    // The framebuffer has to be opened first on some devices, and the mini
+    // SurfaceFlinger started before the device; it returns its library.
+    static void openFramebufferFirst();
+    static void *startMiniSurfaceFlinger();
+    static void openDevice(hw_module_t **module, hw_device_t **device);
+
     // Factory method to get the right hwcomposer backend version
-    static HwComposerBackend *create();
+    static HwComposerBackend *create(hw_module_t *hwc_module, hw_device_t *hwc_device, void *libminisf);
     static void destroy(HwComposerBackend *backend);
 
     // Public API that needs to be implemented by a versioned backend
     virtual EGLNativeDisplayType display() = 0;
-    virtual EGLNativeWindowType createWindow(int width, int height) = 0;
+    // format is the HAL_PIXEL_FORMAT_* of the window buffers
+    virtual EGLNativeWindowType createWindow(int width, int height, int format) = 0;
     virtual void destroyWindow(EGLNativeWindowType window) = 0;
     virtual void swap(EGLNativeDisplayType display, EGLSurface surface) = 0;
+    // Like swap(), damage is the part of the new frame of window that
+    // differs from the previous one, in window coordinates. An empty region
+    // means the whole window.
+    virtual void swapWithDamage(EGLNativeDisplayType display, EGLSurface surface,
+                                EGLNativeWindowType window, const QRegion &damage)
+    { Q_UNUSED(window); Q_UNUSED(damage); swap(display, surface); }
+    // Damage of the next buffer queued on window by other means than a swap
+    virtual void setFrameDamage(EGLNativeWindowType window, const QRegion &damage) { Q_UNUSED(window); Q_UNUSED(damage); }
     virtual void sleepDisplay(bool sleep) = 0;
     virtual float refreshRate() = 0;
 
     virtual bool getScreenSizes(int *width, int *height, float *physical_width, float *physical_height) = 0;
 
+    // Displays besides the primary one, numbered like HWC_DISPLAY_*. Backends
+    // that drive them tell the listener when they are connected, and each
+    // gets a fullscreen window of its own and its own power state.
+    virtual void setDisplayListener(HwComposerDisplayListener *listener) { Q_UNUSED(listener); }
+    virtual bool getDisplaySizes(int display, int *width, int *height, float *physical_width, float *physical_height)
+    { Q_UNUSED(display); Q_UNUSED(width); Q_UNUSED(height); Q_UNUSED(physical_width); Q_UNUSED(physical_height); return false; }
+    virtual float displayRefreshRate(int display) { Q_UNUSED(display); return refreshRate(); }
+    virtual EGLNativeWindowType createDisplayWindow(int display, int width, int height, int format)
+    { Q_UNUSED(display); Q_UNUSED(width); Q_UNUSED(height); Q_UNUSED(format); return 0; }
+    virtual void sleepExternalDisplay(int display, bool sleep) { Q_UNUSED(display); Q_UNUSED(sleep); }
+
     virtual bool requestUpdate(QEglFSWindow *) { return false; }
+    virtual void frameSwapped(QEglFSWindow *) {}
+    // The window is being destroyed, frame pacing state about it goes
+    virtual void forgetWindow(QEglFSWindow *) {}
+
+    // Whether buffers queued to a window by the CPU, without EGL, are
+    // composed like the ones EGL queues
+    virtual bool supportsRasterBuffers() { return false; }
+
+    // Windows besides the fullscreen one get their own hardware layer when
+    // the backend supports it, they are released with destroyWindow()
+    virtual bool supportsLayers() { return false; }
+    virtual EGLNativeWindowType createLayerWindow(int display, int width, int height, int format)
+    { Q_UNUSED(display); Q_UNUSED(width); Q_UNUSED(height); Q_UNUSED(format); return 0; }
+    virtual void setLayerState(EGLNativeWindowType window, const HwComposerLayerState &state) { Q_UNUSED(window); Q_UNUSED(state); }
+
+    // Shows a client buffer fullscreen in its own layer instead of the
+    // primary window. Returns false if the display can not do that without
+    // GL composition, otherwise displayedFenceFd gets a fence (or -1) that
+    // signals once the buffer is on screen.
+    virtual bool scanoutBuffer(ANativeWindowBuffer *buffer, int *displayedFenceFd) { Q_UNUSED(buffer); Q_UNUSED(displayedFenceFd); return false; }
+    // Shows the primary window again, returns a fence (or -1) that signals
+    // once the last scanout buffer is off screen
+    virtual int endScanout() { return -1; }
 
 protected:
     HwComposerBackend(hw_module_t *hwc_module, void *libmsf);
     virtual ~HwComposerBackend();
 
+    // eglSwapBuffers, handing damage to EGL_KHR_swap_buffers_with_damage
+    // where available
+    static void swapBuffersWithDamage(EGLDisplay display, EGLSurface surface, const QRegion &damage);
+
     hw_module_t *hwc_module;
     void *libminisf;
 };
@@ -72,10 +72,11 @@ HwComposerBackend_v0::display()
 }
 
 EGLNativeWindowType
-HwComposerBackend_v0::createWindow(int width, int height)
+HwComposerBackend_v0::createWindow(int width, int height, int format)
 {
     Q_UNUSED(width);
     Q_UNUSED(height);
+    Q_UNUSED(format);
 
     return (EGLNativeWindowType) NULL;
 }
@@ -51,7 +51,7 @@ public:
     virtual ~HwComposerBackend_v0();
 
     virtual EGLNativeDisplayType display();
-    virtual EGLNativeWindowType createWindow(int width, int height);
+    virtual EGLNativeWindowType createWindow(int width, int height, int format);
     virtual void destroyWindow(EGLNativeWindowType window);
     virtual void swap(EGLNativeDisplayType display, EGLSurface surface);
     virtual void sleepDisplay(bool sleep);
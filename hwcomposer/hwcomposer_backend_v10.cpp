@@ -169,8 +169,11 @@ HwComposerBackend_v10::display()
 }
 
 EGLNativeWindowType
-HwComposerBackend_v10::createWindow(int width, int height)
+HwComposerBackend_v10::createWindow(int width, int height, int format)
 {
+    // The framebuffer has a fixed format
+    Q_UNUSED(format);
+
     // We expect that we haven't created a window already, if we had, we
     // would leak stuff, and we want to avoid that for obvious reasons.
     HWC_PLUGIN_EXPECT_NULL(hwc_list);
@@ -55,7 +55,7 @@ public:
     virtual ~HwComposerBackend_v10();
 
     virtual EGLNativeDisplayType display();
-    virtual EGLNativeWindowType createWindow(int width, int height);
+    virtual EGLNativeWindowType createWindow(int width, int height, int format);
     virtual void destroyWindow(EGLNativeWindowType window);
     virtual void swap(EGLNativeDisplayType display, EGLSurface surface);
     virtual void sleepDisplay(bool sleep);
@@ -42,35 +42,32 @@
 #include <android-version.h>
 #include "hwcomposer_backend_v11.h"
 #include "qeglfswindow.h"
+#include "hwcomposer_fence_policy.h"
+#include "hwcomposer_stats.h"
 
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QTimerEvent>
 #include <QtCore/QCoreApplication>
-#include <private/qwindow_p.h>
+#include <QtCore/QMutex>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+#include <QtCore/QSettings>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QFile>
 
 #include "qsystrace_selector.h"
 
 #ifdef HWC_PLUGIN_HAVE_HWCOMPOSER1_API
 
-// #define QPA_HWC_TIMING
-
-#ifdef QPA_HWC_TIMING
-#define QPA_HWC_TIMING_SAMPLE(variable) variable = timer.nsecsElapsed()
-static QElapsedTimer timer;
-static qint64 presentTime;
-static qint64 syncTime;
-static qint64 prepareTime;
-static qint64 setTime;
-#else
-#define QPA_HWC_TIMING_SAMPLE(variable)
-#endif
-
 struct HwcProcs_v11 : public hwc_procs
 {
     HwComposerBackend_v11 *backend;
 };
 
-static void hwc11_callback_vsync(const struct hwc_procs *procs, int, int64_t)
+static void hwc11_callback_vsync(const struct hwc_procs *procs, int disp, int64_t timestamp)
 {
     static int counter = 0;
     ++counter;
@@ -79,113 +76,704 @@ static void hwc11_callback_vsync(const struct hwc_procs *procs, int, int64_t)
     else
         QSystrace::end("graphics", "QPA::vsync", "");
 
-    QCoreApplication::postEvent(static_cast<const HwcProcs_v11 *>(procs)->backend, new QEvent(QEvent::User));
+    static_cast<const HwcProcs_v11 *>(procs)->backend->onVSyncReceived(disp, timestamp);
 }
 
+class HwcVSyncSource_v11 : public HwComposerVSyncSource
+{
+public:
+    HwcVSyncSource_v11(hwc_composer_device_1_t *device, int display)
+        : hwc_device(device)
+        , display(display)
+    {
+    }
+
+protected:
+    void setHardwareVSyncEnabled(bool enabled) Q_DECL_OVERRIDE
+    {
+        hwc_device->eventControl(hwc_device, display, HWC_EVENT_VSYNC, enabled ? 1 : 0);
+    }
+
+private:
+    hwc_composer_device_1_t *hwc_device;
+    int display;
+};
+
 static void hwc11_callback_invalidate(const struct hwc_procs *)
 {
 }
 
-static void hwc11_callback_hotplug(const struct hwc_procs *, int, int)
+static void hwc11_callback_hotplug(const struct hwc_procs *procs, int disp, int connected)
 {
+    static_cast<const HwcProcs_v11 *>(procs)->backend->onHotplug(disp, connected != 0);
 }
 
+// Hotplug events are handled on the GUI thread, where the screens live
+class HwcHotplugEvent_v11 : public QEvent
+{
+public:
+    HwcHotplugEvent_v11(int display, bool connected)
+        : QEvent(eventType())
+        , display(display)
+        , connected(connected)
+    {
+    }
+
+    static QEvent::Type eventType()
+    {
+        static const QEvent::Type type = QEvent::Type(QEvent::registerEventType());
+        return type;
+    }
+
+    int display;
+    bool connected;
+};
+
+
+class HwcComposition_v11;
 
 class HWComposer : public HWComposerNativeWindow
 {
+    friend class HwcComposition_v11;
+    friend class HwComposerBackend_v11;
     private:
-        hwc_layer_1_t *fblayer;
-        hwc_composer_device_1_t *hwcdevice;
-        hwc_display_contents_1_t **mlist;
-        int num_displays;
-        bool m_syncBeforeSet;
-        bool m_waitOnRetireFence;
+        HwcComposition_v11 *composition;
+        // The HWC_DISPLAY_* the window is shown on
+        int m_display;
+        // The buffer currently shown, and whether it still has to be
+        // handed to the hwcomposer along with its acquire fence
+        HWComposerNativeWindowBuffer *m_front;
+        bool m_frontQueued;
+        HwComposerLayerState m_state;
+        bool m_overlayRefused;
+        // Damage of the frame being swapped, and of m_front relative to
+        // the buffer the hwcomposer saw before it. Empty means everything.
+        QRegion m_swapDamage;
+        QRegion m_frontDamage;
+#ifdef HWC_DEVICE_API_VERSION_1_5
+        QVector<hwc_rect_t> m_damageRects;
+#endif
     protected:
         void present(HWComposerNativeWindowBuffer *buffer);
+        int dequeueBuffer(BaseNativeWindowBuffer **buffer, int *fenceFd);
 
     public:
 
     HWComposer(unsigned int width, unsigned int height, unsigned int format,
-            hwc_composer_device_1_t *device, hwc_display_contents_1_t **mList,
-            hwc_layer_1_t *layer, int num_displays);
+            HwcComposition_v11 *composition, int display);
     void set();
 };
 
+// Everything shown on the connected displays. The fullscreen window of a
+// display is rendered into its framebuffer target, every other window on it
+// is a layer on top that the hwcomposer overlays. Presenting any window sets
+// all displays with one prepare and set, so that happens under one lock.
+class HwcComposition_v11
+{
+public:
+    enum { MaxLayers = 8, MaxDisplays = HwComposerBackend_v11::MaxDisplays };
+
+    HwcComposition_v11(hwc_composer_device_1_t *device, int num_displays, float refreshRate);
+    ~HwcComposition_v11();
+
+    void addWindow(HWComposer *window, bool primary);
+    void removeWindow(HWComposer *window);
+    void setLayerState(HWComposer *window, const HwComposerLayerState &state);
+    void setConnected(int display, bool connected);
+    void setEnabled(int display, bool enabled);
+
+    void present(HWComposer *window, HWComposerNativeWindowBuffer *buffer);
+
+    bool scanout(ANativeWindowBuffer *buffer, int *displayedFenceFd);
+    int endScanout();
+
+    // True once a window layer had to be left to GLES composition
+    bool layersRefused() { return m_layersRefused.load() != 0; }
+
+private:
+    struct Display {
+        Display();
+
+        hwc_display_contents_1_t *list;
+        QRect screen;
+        HWComposer *primary;
+        // Bottom to top
+        QList<HWComposer *> layers;
+        QVarLengthArray<HWComposer *, MaxLayers + 2> listed;
+        bool listedScanout;
+        bool layoutChanged;
+        bool connected;
+        bool enabled;
+        int retireFenceFd;
+    };
+
+    // A display is set once its fullscreen window has a frame to show
+    static bool isShown(const Display &display)
+    {
+        return display.connected && display.enabled && display.primary && display.primary->m_front;
+    }
+
+    // displayFrame is set when the commit shows a new frame of the
+    // fullscreen window of the primary display, or a client buffer in
+    // its place
+    void commit(bool displayFrame = false);
+    void fillList(int index, int policy, HwComposerStats::Timer &timer);
+    void checkPrepared(int index);
+    void takeFences(int index);
+    static void initLayer(hwc_layer_1_t *layer, int32_t compositionType, HWComposer *window,
+                          const QRect &screen, bool scanout);
+    static void setSourceCrop(hwc_layer_1_t *layer, const QRect &crop);
+#ifdef HWC_DEVICE_API_VERSION_1_5
+    static void setSurfaceDamage(hwc_layer_1_t *layer, HWComposer *window);
+#endif
+    static void mergeReleaseFence(HWComposer *window, int releaseFenceFd);
+
+    QMutex m_mutex;
+    hwc_composer_device_1_t *hwcdevice;
+    hwc_display_contents_1_t **mlist;
+    int num_displays;
+    // Indexed by HWC_DISPLAY_*
+    Display m_displays[MaxDisplays];
+    // A client buffer shown fullscreen on the primary display in place of
+    // its placeholder layer
+    ANativeWindowBuffer *m_scanout;
+    QSize m_scanoutSize;
+    bool m_scanoutRefused;
+    // Set while presenting, read when windows are created
+    QAtomicInt m_layersRefused;
+    HwComposerFencePolicy m_fencePolicy;
+};
+
 HWComposer::HWComposer(unsigned int width, unsigned int height, unsigned int format,
-        hwc_composer_device_1_t *device, hwc_display_contents_1_t **mList,
-        hwc_layer_1_t *layer, int num_displays)
+        HwcComposition_v11 *composition, int display)
     : HWComposerNativeWindow(width, height, format)
-    , fblayer(layer)
-    , hwcdevice(device)
-    , mlist(mList)
-    , num_displays(num_displays)
+    , composition(composition)
+    , m_display(display)
+    , m_front(NULL)
+    , m_frontQueued(false)
+    , m_overlayRefused(false)
 {
     int bufferCount = qBound(2, qgetenv("QPA_HWC_BUFFER_COUNT").toInt(), 8);
     setBufferCount(bufferCount);
-    m_syncBeforeSet = qEnvironmentVariableIsSet("QPA_HWC_SYNC_BEFORE_SET");
-    m_waitOnRetireFence = qEnvironmentVariableIsSet("QPA_HWC_WAIT_ON_RETIRE_FENCE");
+}
+
+int HWComposer::dequeueBuffer(BaseNativeWindowBuffer **buffer, int *fenceFd)
+{
+    HwComposerStats::Timer timer;
+    int ret = HWComposerNativeWindow::dequeueBuffer(buffer, fenceFd);
+    timer.lap(HwComposerStats::Dequeue);
+    return ret;
 }
 
 void HWComposer::present(HWComposerNativeWindowBuffer *buffer)
 {
     QSystraceEvent trace("graphics", "QPA::present");
 
-    QPA_HWC_TIMING_SAMPLE(presentTime);
+    composition->present(this, buffer);
+}
+
+HwcComposition_v11::Display::Display()
+    : list(NULL)
+    , primary(NULL)
+    , listedScanout(false)
+    , layoutChanged(true)
+    , connected(false)
+    , enabled(false)
+    , retireFenceFd(-1)
+{
+}
 
-    fblayer->handle = buffer->handle;
-    fblayer->releaseFenceFd = -1;
+HwcComposition_v11::HwcComposition_v11(hwc_composer_device_1_t *device, int num_displays, float refreshRate)
+    : hwcdevice(device)
+    , num_displays(num_displays)
+    , m_scanout(NULL)
+    , m_scanoutRefused(false)
+    , m_layersRefused(0)
+    , m_fencePolicy(HwComposerFencePolicy::SyncBeforeSet | HwComposerFencePolicy::WaitOnRetireFence, refreshRate)
+{
+    // Room for the placeholder layer, the overlays and the framebuffer target
+    size_t neededsize = sizeof(hwc_display_contents_1_t) + (MaxLayers + 2) * sizeof(hwc_layer_1_t);
+    for (int i = 0; i < MaxDisplays; i++) {
+        hwc_display_contents_1_t *list = (hwc_display_contents_1_t *) malloc(neededsize);
+        memset(list, 0, neededsize);
+
+        list->retireFenceFd = -1;
+        list->flags = HWC_GEOMETRY_CHANGED;
+        list->numHwLayers = 0;
+#ifdef HWC_DEVICE_API_VERSION_1_3
+        list->outbuf = 0;
+        list->outbufAcquireFenceFd = -1;
+#endif
+        m_displays[i].list = list;
+    }
 
-    int retireFenceFd = -1;
+    // The primary display is always there, the others are hotplugged
+    m_displays[HWC_DISPLAY_PRIMARY].connected = true;
+    m_displays[HWC_DISPLAY_PRIMARY].enabled = true;
 
-    if (m_waitOnRetireFence) {
-        retireFenceFd = mlist[0]->retireFenceFd;
-        mlist[0]->retireFenceFd = -1;
+    // Filled in by every commit. Each display has a list of its own,
+    // otherwise you get tearing if the same one is passed in several places.
+    mlist = (hwc_display_contents_1_t **) malloc(num_displays * sizeof(hwc_display_contents_1_t *));
+    for (int i = 0; i < num_displays; i++) {
+         mlist[i] = NULL;
+    }
+}
+
+HwcComposition_v11::~HwcComposition_v11()
+{
+    for (int i = 0; i < MaxDisplays; i++) {
+        if (m_displays[i].retireFenceFd != -1)
+            close(m_displays[i].retireFenceFd);
+        free(m_displays[i].list);
+    }
+
+    free(mlist);
+}
+
+void HwcComposition_v11::addWindow(HWComposer *window, bool primary)
+{
+    QMutexLocker lock(&m_mutex);
+
+    Display &display = m_displays[window->m_display];
+    if (primary) {
+        display.primary = window;
+        display.screen = QRect(0, 0, window->width(), window->height());
+    } else {
+        display.layers.append(window);
+    }
+    display.layoutChanged = true;
+}
+
+void HwcComposition_v11::removeWindow(HWComposer *window)
+{
+    QMutexLocker lock(&m_mutex);
+
+    Display &display = m_displays[window->m_display];
+    if (window == display.primary) {
+        // Its display is left out of the following commits
+        display.primary = NULL;
+        display.layoutChanged = true;
+        return;
+    }
+
+    if (!display.layers.removeOne(window))
+        return;
+
+    display.layoutChanged = true;
+
+    // Take the layer off the screen before its buffers go away
+    if (isShown(display)) {
+        commit();
+        if (display.retireFenceFd != -1)
+            sync_wait(display.retireFenceFd, 1000);
+    }
+}
+
+void HwcComposition_v11::setLayerState(HWComposer *window, const HwComposerLayerState &state)
+{
+    QMutexLocker lock(&m_mutex);
+
+    Display &display = m_displays[window->m_display];
+    window->m_state = state;
+
+    // Keep the layers sorted by z, windows raised last go on top of
+    // others with the same z
+    display.layers.removeOne(window);
+    int i = display.layers.size();
+    while (i > 0 && display.layers.at(i - 1)->m_state.z > state.z)
+        --i;
+    display.layers.insert(i, window);
+
+    display.layoutChanged = true;
+}
+
+void HwcComposition_v11::setConnected(int index, bool connected)
+{
+    QMutexLocker lock(&m_mutex);
+
+    Display &display = m_displays[index];
+    display.connected = connected;
+    if (connected) {
+        display.list->flags |= HWC_GEOMETRY_CHANGED;
+        display.layoutChanged = true;
+    }
+}
+
+void HwcComposition_v11::setEnabled(int index, bool enabled)
+{
+    QMutexLocker lock(&m_mutex);
+
+    Display &display = m_displays[index];
+    display.enabled = enabled;
+    if (enabled) {
+        display.list->flags |= HWC_GEOMETRY_CHANGED;
+        display.layoutChanged = true;
+    }
+}
+
+void HwcComposition_v11::initLayer(hwc_layer_1_t *layer, int32_t compositionType, HWComposer *window,
+                                   const QRect &screen, bool scanout)
+{
+    // The placeholder or scanout layer and the framebuffer target cover the
+    // screen, overlays are clipped to it
+    QRect frame = screen;
+    QRect crop = screen;
+    if (window && compositionType != HWC_FRAMEBUFFER_TARGET) {
+        frame = window->m_state.geometry & screen;
+        crop = frame.translated(-window->m_state.geometry.topLeft())
+            & QRect(0, 0, window->width(), window->height());
+    }
+
+    memset(layer, 0, sizeof(hwc_layer_1_t));
+    layer->compositionType = compositionType;
+    layer->hints = 0;
+    layer->flags = 0;
+    layer->handle = 0;
+    layer->transform = 0;
+    layer->blending = compositionType == HWC_FRAMEBUFFER_TARGET || !window
+        ? HWC_BLENDING_NONE : HWC_BLENDING_PREMULT;
+    setSourceCrop(layer, crop);
+    const hwc_rect_t r = { frame.left(), frame.top(), frame.right() + 1, frame.bottom() + 1 };
+    layer->displayFrame = r;
+    layer->visibleRegionScreen.numRects = 1;
+    layer->visibleRegionScreen.rects = &layer->displayFrame;
+    layer->acquireFenceFd = -1;
+    layer->releaseFenceFd = -1;
+#if (ANDROID_VERSION_MAJOR >= 4) && (ANDROID_VERSION_MINOR >= 3) || (ANDROID_VERSION_MAJOR >= 5)
+    if (!window && !scanout) {
+        // We've observed that qualcomm chipsets enters into compositionType == 6
+        // (HWC_BLIT), an undocumented composition type which gives us rendering
+        // glitches and warnings in logcat. By setting the planarAlpha to non-
+        // opaque, we attempt to force the HWC into using HWC_FRAMEBUFFER for this
+        // layer so the HWC_FRAMEBUFFER_TARGET layer actually gets used.
+        bool tryToForceGLES = !qgetenv("QPA_HWC_FORCE_GLES").isEmpty();
+        layer->planeAlpha = tryToForceGLES ? 1 : 255;
+    } else if (!window || compositionType == HWC_FRAMEBUFFER_TARGET) {
+        layer->planeAlpha = 0xff;
+    } else {
+        layer->planeAlpha = qBound(0, qRound(window->m_state.opacity * 255), 255);
     }
+#else
+    Q_UNUSED(scanout);
+#endif
+#ifdef HWC_DEVICE_API_VERSION_1_5
+    layer->surfaceDamage.numRects = 0;
+#endif
+}
+
+void HwcComposition_v11::setSourceCrop(hwc_layer_1_t *layer, const QRect &crop)
+{
+#ifdef HWC_DEVICE_API_VERSION_1_3
+    layer->sourceCropf.top = (float) crop.top();
+    layer->sourceCropf.left = (float) crop.left();
+    layer->sourceCropf.bottom = (float) (crop.bottom() + 1);
+    layer->sourceCropf.right = (float) (crop.right() + 1);
+#else
+    const hwc_rect_t c = { crop.left(), crop.top(), crop.right() + 1, crop.bottom() + 1 };
+    layer->sourceCrop = c;
+#endif
+}
+
+#ifdef HWC_DEVICE_API_VERSION_1_5
+void HwcComposition_v11::setSurfaceDamage(hwc_layer_1_t *layer, HWComposer *window)
+{
+    window->m_damageRects.clear();
 
-    if (m_syncBeforeSet) {
-        int acqFd = getFenceBufferFd(buffer);
-        if (acqFd >= 0) {
-            sync_wait(acqFd, -1);
-            close(acqFd);
-            fblayer->acquireFenceFd = -1;
+    if (!window->m_frontQueued) {
+        // Same buffer as last time, a single empty rectangle says so
+        hwc_rect_t none = { 0, 0, 0, 0 };
+        window->m_damageRects.append(none);
+    } else {
+        // Damage is in buffer coordinates, no rectangles means all of it
+        const QRegion damage = window->m_frontDamage & QRect(0, 0, window->width(), window->height());
+        foreach (const QRect &rect, damage.rects()) {
+            hwc_rect_t r = { rect.left(), rect.top(), rect.right() + 1, rect.bottom() + 1 };
+            window->m_damageRects.append(r);
         }
+    }
+
+    layer->surfaceDamage.numRects = window->m_damageRects.size();
+    layer->surfaceDamage.rects = window->m_damageRects.constData();
+}
+#endif
+
+void HwcComposition_v11::mergeReleaseFence(HWComposer *window, int releaseFenceFd)
+{
+    if (releaseFenceFd < 0)
+        return;
+
+    // The buffer stays on screen, it can only be reused once every set it
+    // was part of is done with it
+    int fenceFd = window->getFenceBufferFd(window->m_front);
+    if (fenceFd >= 0) {
+        int merged = sync_merge("qpa-hwc-release", fenceFd, releaseFenceFd);
+        close(fenceFd);
+        close(releaseFenceFd);
+        fenceFd = merged;
     } else {
-        fblayer->acquireFenceFd = getFenceBufferFd(buffer);
+        fenceFd = releaseFenceFd;
+    }
+    window->setFenceBufferFd(window->m_front, fenceFd);
+}
+
+void HwcComposition_v11::present(HWComposer *window, HWComposerNativeWindowBuffer *buffer)
+{
+    QMutexLocker lock(&m_mutex);
+
+    // Frames the hwcomposer never saw add their damage to this one
+    if (!window->m_frontQueued)
+        window->m_frontDamage = window->m_swapDamage;
+    else if (window->m_frontDamage.isEmpty() || window->m_swapDamage.isEmpty())
+        window->m_frontDamage = QRegion();
+    else
+        window->m_frontDamage |= window->m_swapDamage;
+    window->m_swapDamage = QRegion();
+
+    window->m_front = buffer;
+    window->m_frontQueued = true;
+
+    // Layers wait for the fullscreen window of their display to be shown
+    // underneath them
+    if (!isShown(m_displays[window->m_display]))
+        return;
+
+    commit(window == m_displays[HWC_DISPLAY_PRIMARY].primary);
+}
+
+bool HwcComposition_v11::scanout(ANativeWindowBuffer *buffer, int *displayedFenceFd)
+{
+    QMutexLocker lock(&m_mutex);
+
+    const Display &primary = m_displays[HWC_DISPLAY_PRIMARY];
+    if (!isShown(primary) || m_scanoutRefused)
+        return false;
+
+    m_scanout = buffer;
+    commit(true);
+
+    if (m_scanoutRefused) {
+        qDebug("QPA-HWC: hwcomposer can not overlay client buffers, using GL composition");
+        m_scanout = NULL;
+        return false;
     }
 
-    QPA_HWC_TIMING_SAMPLE(syncTime);
+    *displayedFenceFd = primary.retireFenceFd != -1 ? dup(primary.retireFenceFd) : -1;
+    return true;
+}
 
+int HwcComposition_v11::endScanout()
+{
+    QMutexLocker lock(&m_mutex);
+
+    // A later buffer may fit where this one did not
+    m_scanoutRefused = false;
+
+    if (!m_scanout)
+        return -1;
+
+    m_scanout = NULL;
+    const Display &primary = m_displays[HWC_DISPLAY_PRIMARY];
+    if (!isShown(primary))
+        return -1;
+
+    commit();
+    return primary.retireFenceFd != -1 ? dup(primary.retireFenceFd) : -1;
+}
+
+void HwcComposition_v11::commit(bool displayFrame)
+{
+    HwComposerStats::Timer timer;
+
+    const int policy = m_fencePolicy.beginFrame();
+
+    // Always take the previous retire fences, the policy may have changed
+    // since the frame that produced them
+    int retireFenceFds[MaxDisplays];
+    for (int i = 0; i < MaxDisplays; ++i) {
+        retireFenceFds[i] = m_displays[i].retireFenceFd;
+        m_displays[i].retireFenceFd = -1;
+    }
+
+    // Every display with something to show goes into the same prepare and
+    // set, the others are left out of them
+    for (int i = 0; i < num_displays; ++i) {
+        mlist[i] = NULL;
+        if (i < MaxDisplays && isShown(m_displays[i])) {
+            fillList(i, policy, timer);
+            mlist[i] = m_displays[i].list;
+        }
+    }
+
+    timer.restart();
     int err = hwcdevice->prepare(hwcdevice, num_displays, mlist);
     HWC_PLUGIN_EXPECT_ZERO(err);
+    timer.lap(HwComposerStats::Prepare);
 
-    QPA_HWC_TIMING_SAMPLE(prepareTime);
+    for (int i = 0; i < MaxDisplays && i < num_displays; ++i) {
+        if (mlist[i])
+            checkPrepared(i);
+    }
 
     QSystrace::begin("graphics", "QPA::set", "");
     err = hwcdevice->set(hwcdevice, num_displays, mlist);
     HWC_PLUGIN_EXPECT_ZERO(err);
     QSystrace::end("graphics", "QPA::set", "");
+    timer.lap(HwComposerStats::Present);
 
-    QPA_HWC_TIMING_SAMPLE(setTime);
+    for (int i = 0; i < MaxDisplays && i < num_displays; ++i) {
+        if (mlist[i])
+            takeFences(i);
+    }
 
-    setFenceBufferFd(buffer, fblayer->releaseFenceFd);
+    for (int i = 0; i < MaxDisplays; ++i) {
+        if (retireFenceFds[i] == -1)
+            continue;
 
-    if (m_waitOnRetireFence && retireFenceFd != -1) {
-        sync_wait(retireFenceFd, -1);
-        close(retireFenceFd);
-    } else if (!m_waitOnRetireFence && mlist[0]->retireFenceFd != -1) {
-        close(mlist[0]->retireFenceFd);
-        mlist[0]->retireFenceFd = -1;
+        if (policy & HwComposerFencePolicy::WaitOnRetireFence) {
+            sync_wait(retireFenceFds[i], -1);
+            timer.lap(HwComposerStats::RetireFenceWait);
+        }
+        close(retireFenceFds[i]);
     }
+
+    m_fencePolicy.endFrame(displayFrame, m_displays[HWC_DISPLAY_PRIMARY].retireFenceFd);
+}
+
+void HwcComposition_v11::fillList(int index, int policy, HwComposerStats::Timer &timer)
+{
+    Display &display = m_displays[index];
+    hwc_display_contents_1_t *list = display.list;
+    ANativeWindowBuffer *scanout = index == HWC_DISPLAY_PRIMARY ? m_scanout : NULL;
+
+    // The list is a placeholder layer that makes the hwcomposer use the
+    // framebuffer target (or the scanout buffer replacing it), the overlays
+    // from bottom to top and the framebuffer target holding the fullscreen
+    // window
+    QVarLengthArray<HWComposer *, MaxLayers + 2> listed;
+    listed.append(NULL);
+    foreach (HWComposer *layer, display.layers) {
+        if (layer->m_state.visible && layer->m_front && listed.size() <= MaxLayers)
+            listed.append(layer);
+    }
+    listed.append(display.primary);
+
+    if (listed.size() != display.listed.size()
+            || memcmp(listed.constData(), display.listed.constData(), listed.size() * sizeof(HWComposer *))
+            || display.listedScanout != (scanout != NULL))
+        display.layoutChanged = true;
+
+    if (display.layoutChanged) {
+        for (int i = 0; i < listed.size(); ++i) {
+            initLayer(&list->hwLayers[i],
+                      i == listed.size() - 1 ? HWC_FRAMEBUFFER_TARGET : HWC_FRAMEBUFFER,
+                      listed[i], display.screen, scanout != NULL);
+        }
+        list->numHwLayers = listed.size();
+        list->flags |= HWC_GEOMETRY_CHANGED;
+        display.listed = listed;
+        display.listedScanout = scanout != NULL;
+        display.layoutChanged = false;
+        m_scanoutSize = QSize();
+    }
+
+    if (scanout) {
+        // The whole buffer is scaled to the screen, whatever its size
+        hwc_layer_1_t *layer = &list->hwLayers[0];
+        const QSize size(scanout->width, scanout->height);
+        if (size != m_scanoutSize) {
+            setSourceCrop(layer, QRect(QPoint(0, 0), size));
+            list->flags |= HWC_GEOMETRY_CHANGED;
+            m_scanoutSize = size;
+        }
+
+        // Client buffers are complete by the time they are handed over
+        layer->handle = scanout->handle;
+        layer->acquireFenceFd = -1;
+        layer->releaseFenceFd = -1;
+    }
+
+    for (int i = 1; i < listed.size(); ++i) {
+        HWComposer *w = listed[i];
+        hwc_layer_1_t *layer = &list->hwLayers[i];
+        layer->handle = w->m_front->handle;
+        layer->acquireFenceFd = -1;
+        layer->releaseFenceFd = -1;
+#ifdef HWC_DEVICE_API_VERSION_1_5
+        setSurfaceDamage(layer, w);
+#endif
+
+        if (!w->m_frontQueued)
+            continue;
+
+        int acqFd = w->getFenceBufferFd(w->m_front);
+        w->setFenceBufferFd(w->m_front, -1);
+        if (policy & HwComposerFencePolicy::SyncBeforeSet) {
+            if (acqFd >= 0) {
+                sync_wait(acqFd, -1);
+                close(acqFd);
+                timer.lap(HwComposerStats::AcquireFenceWait);
+            }
+        } else {
+            layer->acquireFenceFd = acqFd;
+        }
+    }
+}
+
+void HwcComposition_v11::checkPrepared(int index)
+{
+    const Display &display = m_displays[index];
+    const hwc_display_contents_1_t *list = display.list;
+
+    // Layers left to GLES composition would have to be drawn into the
+    // framebuffer target, which only holds the fullscreen window
+    if (index == HWC_DISPLAY_PRIMARY && m_scanout && list->hwLayers[0].compositionType == HWC_FRAMEBUFFER)
+        m_scanoutRefused = true;
+    for (int i = 1; i < display.listed.size() - 1; ++i) {
+        if (list->hwLayers[i].compositionType == HWC_FRAMEBUFFER && !display.listed[i]->m_overlayRefused) {
+            qWarning("QPA-HWC: hwcomposer can not overlay window layer %d of display %d, it will not be visible "
+                     "and no more windows are made layers", i, index);
+            display.listed[i]->m_overlayRefused = true;
+            m_layersRefused.storeRelease(1);
+        }
+    }
+}
+
+void HwcComposition_v11::takeFences(int index)
+{
+    Display &display = m_displays[index];
+    hwc_display_contents_1_t *list = display.list;
+
+    // Scanout buffers are released once the next frame is on screen
+    if (index == HWC_DISPLAY_PRIMARY && m_scanout && list->hwLayers[0].releaseFenceFd != -1) {
+        close(list->hwLayers[0].releaseFenceFd);
+        list->hwLayers[0].releaseFenceFd = -1;
+    }
+
+    for (int i = 1; i < display.listed.size(); ++i) {
+        HWComposer *w = display.listed[i];
+        const int releaseFenceFd = list->hwLayers[i].releaseFenceFd;
+        if (w->m_frontQueued) {
+            w->setFenceBufferFd(w->m_front, releaseFenceFd);
+            w->m_frontQueued = false;
+        } else {
+            mergeReleaseFence(w, releaseFenceFd);
+        }
+    }
+
+    display.retireFenceFd = list->retireFenceFd;
+    list->retireFenceFd = -1;
 }
 
 HwComposerBackend_v11::HwComposerBackend_v11(hw_module_t *hwc_module, hw_device_t *hw_device, void *libminisf, int num_displays)
     : HwComposerBackend(hwc_module, libminisf)
     , hwc_device((hwc_composer_device_1_t *)hw_device)
-    , hwc_list(NULL)
-    , hwc_mList(NULL)
     , num_displays(num_displays)
-    , m_displayOff(true)
+    , m_composition(NULL)
+    , m_primaryWindow(NULL)
+    , m_displayListener(NULL)
 {
+    // Displays that are already connected get a hotplug event right away,
+    // it is handled once the GUI thread gets to it
     procs = new HwcProcs_v11();
     procs->invalidate = hwc11_callback_invalidate;
     procs->hotplug = hwc11_callback_hotplug;
@@ -195,25 +783,43 @@ HwComposerBackend_v11::HwComposerBackend_v11(hw_module_t *hwc_module, hw_device_
     hwc_device->registerProcs(hwc_device, procs);
 
     hwc_version = interpreted_version(hw_device);
+
+    for (int i = 0; i < MaxDisplays; i++) {
+        m_connected[i] = i == HWC_DISPLAY_PRIMARY;
+        m_displayOff[i] = true;
+        m_attributesValid[i] = false;
+
+        m_vsyncSources[i] = new HwcVSyncSource_v11(hwc_device, i);
+        m_schedulers[i].setVSyncSource(m_vsyncSources[i]);
+    }
+    m_schedulers[HWC_DISPLAY_PRIMARY].setRefreshRate(refreshRate());
+
+    // Other displays stay suspended until they are plugged in
+    for (int i = HWC_DISPLAY_PRIMARY + 1; i < MaxDisplays; i++)
+        m_vsyncSources[i]->suspend();
+
+    m_composition = new HwcComposition_v11(hwc_device, num_displays, refreshRate());
+
     sleepDisplay(false);
 }
 
 HwComposerBackend_v11::~HwComposerBackend_v11()
 {
-    hwc_device->eventControl(hwc_device, 0, HWC_EVENT_VSYNC, 0);
+    for (int i = 0; i < MaxDisplays; i++) {
+        if (m_connected[i])
+            hwc_device->eventControl(hwc_device, i, HWC_EVENT_VSYNC, 0);
+    }
 
     // Close the hwcomposer handle
     if (!qgetenv("QPA_HWC_WORKAROUNDS").split(',').contains("no-close-hwc"))
         HWC_PLUGIN_EXPECT_ZERO(hwc_close_1(hwc_device));
 
-    if (hwc_mList != NULL) {
-        free(hwc_mList);
-    }
+    delete m_composition;
 
-    if (hwc_list != NULL) {
-        free(hwc_list);
+    for (int i = 0; i < MaxDisplays; i++) {
+        m_schedulers[i].setVSyncSource(NULL);
+        delete m_vsyncSources[i];
     }
-
     delete procs;
 }
 
@@ -224,178 +830,237 @@ HwComposerBackend_v11::display()
 }
 
 EGLNativeWindowType
-HwComposerBackend_v11::createWindow(int width, int height)
+HwComposerBackend_v11::createWindow(int width, int height, int format)
 {
     // We expect that we haven't created a window already, if we had, we
     // would leak stuff, and we want to avoid that for obvious reasons.
-    HWC_PLUGIN_EXPECT_NULL(hwc_list);
-    HWC_PLUGIN_EXPECT_NULL(hwc_mList);
+    HWC_PLUGIN_EXPECT_NULL(m_primaryWindow);
 
-    size_t neededsize = sizeof(hwc_display_contents_1_t) + 2 * sizeof(hwc_layer_1_t);
-    hwc_list = (hwc_display_contents_1_t *) malloc(neededsize);
-    hwc_mList = (hwc_display_contents_1_t **) malloc(num_displays * sizeof(hwc_display_contents_1_t *));
-    const hwc_rect_t r = { 0, 0, width, height };
+    HWComposer *hwc_win = new HWComposer(width, height, format,
+                                         m_composition, HWC_DISPLAY_PRIMARY);
+    m_composition->addWindow(hwc_win, true);
+    m_primaryWindow = hwc_win;
+    return (EGLNativeWindowType) static_cast<ANativeWindow *>(hwc_win);
+}
 
-    for (int i = 0; i < num_displays; i++) {
-         hwc_mList[i] = NULL;
-    }
-    // Assign buffer only to the first item, otherwise you get tearing
-    // if passed the same to multiple places
-    hwc_mList[0] = hwc_list;
+EGLNativeWindowType
+HwComposerBackend_v11::createDisplayWindow(int display, int width, int height, int format)
+{
+    if (display <= HWC_DISPLAY_PRIMARY || display >= MaxDisplays)
+        return 0;
+
+    // Unlike the primary window, this one goes away with its screen. The
+    // backend holds a reference until destroyWindow(), an EGL surface
+    // holds another while it exists.
+    HWComposer *hwc_win = new HWComposer(width, height, format,
+                                         m_composition, display);
+    hwc_win->common.incRef(&hwc_win->common);
+    m_composition->addWindow(hwc_win, true);
+    return (EGLNativeWindowType) static_cast<ANativeWindow *>(hwc_win);
+}
 
-    hwc_layer_1_t *layer = NULL;
+EGLNativeWindowType
+HwComposerBackend_v11::createLayerWindow(int display, int width, int height, int format)
+{
+    if (display < HWC_DISPLAY_PRIMARY || display >= MaxDisplays)
+        return 0;
 
-    layer = &hwc_list->hwLayers[0];
-    memset(layer, 0, sizeof(hwc_layer_1_t));
-    layer->compositionType = HWC_FRAMEBUFFER;
-    layer->hints = 0;
-    layer->flags = 0;
-    layer->handle = 0;
-    layer->transform = 0;
-    layer->blending = HWC_BLENDING_NONE;
-#ifdef HWC_DEVICE_API_VERSION_1_3
-    layer->sourceCropf.top = 0.0f;
-    layer->sourceCropf.left = 0.0f;
-    layer->sourceCropf.bottom = (float) height;
-    layer->sourceCropf.right = (float) width;
-#else
-    layer->sourceCrop = r;
-#endif
-    layer->displayFrame = r;
-    layer->visibleRegionScreen.numRects = 1;
-    layer->visibleRegionScreen.rects = &layer->displayFrame;
-    layer->acquireFenceFd = -1;
-    layer->releaseFenceFd = -1;
-#if (ANDROID_VERSION_MAJOR >= 4) && (ANDROID_VERSION_MINOR >= 3) || (ANDROID_VERSION_MAJOR >= 5)
-    // We've observed that qualcomm chipsets enters into compositionType == 6
-    // (HWC_BLIT), an undocumented composition type which gives us rendering
-    // glitches and warnings in logcat. By setting the planarAlpha to non-
-    // opaque, we attempt to force the HWC into using HWC_FRAMEBUFFER for this
-    // layer so the HWC_FRAMEBUFFER_TARGET layer actually gets used.
-    bool tryToForceGLES = !qgetenv("QPA_HWC_FORCE_GLES").isEmpty();
-    layer->planeAlpha = tryToForceGLES ? 1 : 255;
-#endif
-#ifdef HWC_DEVICE_API_VERSION_1_5
-    layer->surfaceDamage.numRects = 0;
-#endif
+    HWComposer *hwc_win = new HWComposer(width, height, format,
+                                         m_composition, display);
+    hwc_win->common.incRef(&hwc_win->common);
+    m_composition->addWindow(hwc_win, false);
+    return (EGLNativeWindowType) static_cast<ANativeWindow *>(hwc_win);
+}
 
-    layer = &hwc_list->hwLayers[1];
-    memset(layer, 0, sizeof(hwc_layer_1_t));
-    layer->compositionType = HWC_FRAMEBUFFER_TARGET;
-    layer->hints = 0;
-    layer->flags = 0;
-    layer->handle = 0;
-    layer->transform = 0;
-    layer->blending = HWC_BLENDING_NONE;
-#ifdef HWC_DEVICE_API_VERSION_1_3
-    layer->sourceCropf.top = 0.0f;
-    layer->sourceCropf.left = 0.0f;
-    layer->sourceCropf.bottom = (float) height;
-    layer->sourceCropf.right = (float) width;
-#else
-    layer->sourceCrop = r;
-#endif
-    layer->displayFrame = r;
-    layer->visibleRegionScreen.numRects = 1;
-    layer->visibleRegionScreen.rects = &layer->displayFrame;
-    layer->acquireFenceFd = -1;
-    layer->releaseFenceFd = -1;
-#if (ANDROID_VERSION_MAJOR >= 4) && (ANDROID_VERSION_MINOR >= 3) || (ANDROID_VERSION_MAJOR >= 5)
-    layer->planeAlpha = 0xff;
-#endif
-#ifdef HWC_DEVICE_API_VERSION_1_5
-    layer->surfaceDamage.numRects = 0;
-#endif
+void
+HwComposerBackend_v11::setLayerState(EGLNativeWindowType window, const HwComposerLayerState &state)
+{
+    HWComposer *hwc_win = static_cast<HWComposer *>((ANativeWindow *) window);
+    m_composition->setLayerState(hwc_win, state);
+}
 
-    hwc_list->retireFenceFd = -1;
-    hwc_list->flags = HWC_GEOMETRY_CHANGED;
-    hwc_list->numHwLayers = 2;
-#ifdef HWC_DEVICE_API_VERSION_1_3
-    hwc_list->outbuf = 0;
-    hwc_list->outbufAcquireFenceFd = -1;
-#endif
+bool
+HwComposerBackend_v11::supportsRasterBuffers()
+{
+    return true;
+}
 
+bool
+HwComposerBackend_v11::supportsLayers()
+{
+    // Windows the hwcomposer can not overlay would stay invisible, later
+    // ones are drawn with the fullscreen window instead
+    return !m_composition->layersRefused();
+}
 
-    HWComposer *hwc_win = new HWComposer(width, height, HAL_PIXEL_FORMAT_RGBA_8888,
-                                         hwc_device, hwc_mList, &hwc_list->hwLayers[1], num_displays);
-    return (EGLNativeWindowType) static_cast<ANativeWindow *>(hwc_win);
+bool
+HwComposerBackend_v11::scanoutBuffer(ANativeWindowBuffer *buffer, int *displayedFenceFd)
+{
+    return m_composition->scanout(buffer, displayedFenceFd);
+}
+
+int
+HwComposerBackend_v11::endScanout()
+{
+    return m_composition->endScanout();
 }
 
 void
 HwComposerBackend_v11::destroyWindow(EGLNativeWindowType window)
 {
-    Q_UNUSED(window);
+    HWComposer *hwc_win = static_cast<HWComposer *>((ANativeWindow *) window);
+
+    // The primary window lives as long as the backend
+    if (hwc_win == m_primaryWindow)
+        return;
+
+    // Off screen once this returns, the window and its buffers go with
+    // the last reference
+    m_composition->removeWindow(hwc_win);
+    hwc_win->common.decRef(&hwc_win->common);
 }
 
 void
 HwComposerBackend_v11::swap(EGLNativeDisplayType display, EGLSurface surface)
 {
-#ifdef QPA_HWC_TIMING
-    timer.start();
-#endif
-
     eglSwapBuffers(display, surface);
+}
 
-#ifdef QPA_HWC_TIMING
-    qDebug("HWComposerBackend::swap(), present=%.3f, sync=%.3f, prepare=%.3f, set=%.3f, total=%.3f",
-           presentTime / 1000000.0,
-           (syncTime - presentTime) / 1000000.0,
-           (prepareTime - syncTime) / 1000000.0,
-           (setTime - prepareTime) / 1000000.0,
-           timer.nsecsElapsed() / 1000000.0);
-#endif
+void
+HwComposerBackend_v11::swapWithDamage(EGLNativeDisplayType display, EGLSurface surface,
+                                      EGLNativeWindowType window, const QRegion &damage)
+{
+    // The window is presented from within eglSwapBuffers on this thread
+    setFrameDamage(window, damage);
+    swapBuffersWithDamage(display, surface, damage);
+}
+
+void
+HwComposerBackend_v11::setFrameDamage(EGLNativeWindowType window, const QRegion &damage)
+{
+    HWComposer *hwc_win = static_cast<HWComposer *>((ANativeWindow *) window);
+    hwc_win->m_swapDamage = damage;
 }
 
 void
 HwComposerBackend_v11::sleepDisplay(bool sleep)
 {
-    m_displayOff = sleep;
-    if (sleep) {
-        // Stop the timer so we don't end up calling into eventControl after the
+    setDisplayPower(HWC_DISPLAY_PRIMARY, !sleep);
+}
+
+void
+HwComposerBackend_v11::sleepExternalDisplay(int display, bool sleep)
+{
+    if (display <= HWC_DISPLAY_PRIMARY || display >= MaxDisplays || !m_connected[display])
+        return;
+
+    setDisplayPower(display, !sleep);
+}
+
+void
+HwComposerBackend_v11::setDisplayPower(int display, bool on)
+{
+    m_displayOff[display] = !on;
+    if (!on) {
+        // Suspend vsync so we don't end up calling into eventControl after the
         // screen has been turned off. Doing so leads to logcat errors being
         // logged.
-        m_vsyncTimeout.stop();
-        hwc_device->eventControl(hwc_device, 0, HWC_EVENT_VSYNC, 0);
+        m_vsyncSources[display]->suspend();
 
-#ifdef HWC_DEVICE_API_VERSION_1_4
-        if (hwc_version == HWC_DEVICE_API_VERSION_1_4) {
-            HWC_PLUGIN_EXPECT_ZERO(hwc_device->setPowerMode(hwc_device, 0, HWC_POWER_MODE_OFF));
-        } else
-#endif
-#ifdef HWC_DEVICE_API_VERSION_1_5
-        if (hwc_version == HWC_DEVICE_API_VERSION_1_5) {
-            HWC_PLUGIN_EXPECT_ZERO(hwc_device->setPowerMode(hwc_device, 0, HWC_POWER_MODE_OFF));
-        } else
-#endif
-            HWC_PLUGIN_EXPECT_ZERO(hwc_device->blank(hwc_device, 0, 1));
+        m_composition->setEnabled(display, false);
+
+        setPowerMode(display, false);
     } else {
+        setPowerMode(display, true);
+
+        m_composition->setEnabled(display, true);
+
+        m_vsyncSources[display]->resume();
+
+        // If we have pending updates, make sure those start happening now..
+        if (m_schedulers[display].hasPendingUpdates())
+            m_schedulers[display].requestVSync();
+    }
+}
+
+void
+HwComposerBackend_v11::setPowerMode(int display, bool on)
+{
 #ifdef HWC_DEVICE_API_VERSION_1_4
-        if (hwc_version == HWC_DEVICE_API_VERSION_1_4) {
-            HWC_PLUGIN_EXPECT_ZERO(hwc_device->setPowerMode(hwc_device, 0, HWC_POWER_MODE_NORMAL));
-        } else
+    if (hwc_version == HWC_DEVICE_API_VERSION_1_4) {
+        HWC_PLUGIN_EXPECT_ZERO(hwc_device->setPowerMode(hwc_device, display,
+                                                        on ? HWC_POWER_MODE_NORMAL : HWC_POWER_MODE_OFF));
+    } else
 #endif
 #ifdef HWC_DEVICE_API_VERSION_1_5
-        if (hwc_version == HWC_DEVICE_API_VERSION_1_5) {
-            HWC_PLUGIN_EXPECT_ZERO(hwc_device->setPowerMode(hwc_device, 0, HWC_POWER_MODE_NORMAL));
-        } else
+    if (hwc_version == HWC_DEVICE_API_VERSION_1_5) {
+        HWC_PLUGIN_EXPECT_ZERO(hwc_device->setPowerMode(hwc_device, display,
+                                                        on ? HWC_POWER_MODE_NORMAL : HWC_POWER_MODE_OFF));
+    } else
 #endif
-            HWC_PLUGIN_EXPECT_ZERO(hwc_device->blank(hwc_device, 0, 0));
+        HWC_PLUGIN_EXPECT_ZERO(hwc_device->blank(hwc_device, display, on ? 0 : 1));
+}
 
-        if (hwc_list) {
-            hwc_list->flags |= HWC_GEOMETRY_CHANGED;
-        }
+void
+HwComposerBackend_v11::setDisplayListener(HwComposerDisplayListener *listener)
+{
+    m_displayListener = listener;
+}
 
-        // If we have pending updates, make sure those start happening now..
-        if (m_pendingUpdate.size()) {
-            hwc_device->eventControl(hwc_device, 0, HWC_EVENT_VSYNC, 1);
-            m_vsyncTimeout.start(50, this);
-        }
+void HwComposerBackend_v11::onHotplug(int display, bool connected)
+{
+    // The primary display never goes away, virtual ones are not driven
+    if (display <= HWC_DISPLAY_PRIMARY || display >= MaxDisplays)
+        return;
+
+    QCoreApplication::postEvent(this, new HwcHotplugEvent_v11(display, connected));
+}
+
+void HwComposerBackend_v11::customEvent(QEvent *e)
+{
+    if (e->type() == HwcHotplugEvent_v11::eventType()) {
+        HwcHotplugEvent_v11 *hotplug = static_cast<HwcHotplugEvent_v11 *>(e);
+        handleHotplug(hotplug->display, hotplug->connected);
+        return;
     }
+
+    QObject::customEvent(e);
 }
 
-int HwComposerBackend_v11::getSingleAttribute(uint32_t attribute)
+void HwComposerBackend_v11::handleHotplug(int display, bool connected)
 {
-    uint32_t config;
+    if (m_connected[display] == connected)
+        return;
+
+    qDebug("QPA-HWC: display %d %s", display, connected ? "connected" : "disconnected");
+
+    // A different monitor may have been plugged in
+    m_attributesValid[display] = false;
+
+    if (connected) {
+        m_connected[display] = true;
+        m_schedulers[display].setRefreshRate(displayRefreshRate(display));
+        m_composition->setConnected(display, true);
+        setDisplayPower(display, true);
+
+        if (m_displayListener)
+            m_displayListener->displayConnected(display);
+    } else {
+        // The screen and its windows go away first, the display can not be
+        // powered down anymore
+        if (m_displayListener)
+            m_displayListener->displayDisconnected(display);
+
+        m_connected[display] = false;
+        m_displayOff[display] = true;
+        m_vsyncSources[display]->suspend();
+        m_composition->setConnected(display, false);
+    }
+}
+
+uint32_t HwComposerBackend_v11::activeConfig(int display)
+{
+    uint32_t config = 0;
 
     if (hwc_version == HWC_DEVICE_API_VERSION_1_1
 #ifdef HWC_DEVICE_API_VERSION_1_2
@@ -408,40 +1073,129 @@ int HwComposerBackend_v11::getSingleAttribute(uint32_t attribute)
     {
         /* 1.3 or lower, currently active config is the first config */
         size_t numConfigs = 1;
-        hwc_device->getDisplayConfigs(hwc_device, 0, &config, &numConfigs);
+        hwc_device->getDisplayConfigs(hwc_device, display, &config, &numConfigs);
     }
 #ifdef HWC_DEVICE_API_VERSION_1_4
     else {
         /* 1.4 or higher */
-        config = hwc_device->getActiveConfig(hwc_device, 0);
+        config = hwc_device->getActiveConfig(hwc_device, display);
     }
 #endif
 
-    const uint32_t attributes[] = {
-        attribute,
-        HWC_DISPLAY_NO_ATTRIBUTE,
-    };
+    return config;
+}
+
+static const uint32_t displayAttributes[] = {
+    HWC_DISPLAY_VSYNC_PERIOD,
+    HWC_DISPLAY_WIDTH,
+    HWC_DISPLAY_HEIGHT,
+    HWC_DISPLAY_DPI_X,
+    HWC_DISPLAY_DPI_Y,
+    HWC_DISPLAY_NO_ATTRIBUTE,
+};
+
+static const char *displayAttributeNames[] = {
+    "vsyncPeriod",
+    "width",
+    "height",
+    "dpiX",
+    "dpiY",
+};
+
+static QString displayCachePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QLatin1String("/qpa-hwc/display.conf");
+}
 
-    int32_t values[] = {
-        0,
-        0,
+// Fingerprint of the Android build the hwcomposer HAL came with, HALs of
+// different devices and builds share a module id
+static QByteArray halBuildFingerprint()
+{
+    static const char *const buildProps[] = {
+        "/vendor/build.prop",
+        "/system/build.prop",
+        "/system/system/build.prop"
     };
 
-    hwc_device->getDisplayAttributes(hwc_device, 0, config, attributes, values);
+    for (size_t i = 0; i < sizeof(buildProps) / sizeof(buildProps[0]); ++i) {
+        QFile file(QLatin1String(buildProps[i]));
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+
+        while (!file.atEnd()) {
+            const QByteArray line = file.readLine().trimmed();
+            if (line.startsWith("ro.vendor.build.fingerprint=") || line.startsWith("ro.build.fingerprint="))
+                return line.mid(line.indexOf('=') + 1);
+        }
+    }
+    return QByteArray();
+}
+
+const int32_t *HwComposerBackend_v11::displayAttributeValues(int display)
+{
+    // The plugin never switches configs, the active one only changes
+    // with what is plugged in, so it is not asked for again until a
+    // hotplug event
+    int32_t *attributes = m_attributes[display];
+    if (m_attributesValid[display])
+        return attributes;
+
+    const uint32_t config = activeConfig(display);
+
+    // The same hwcomposer module of the same build reports the same
+    // attributes every boot, unless QPA_HWC_WORKAROUNDS=no-display-cache
+    // says otherwise. What is plugged into the other displays is not.
+    const bool useCache = display == HWC_DISPLAY_PRIMARY
+        && !qgetenv("QPA_HWC_WORKAROUNDS").split(',').contains("no-display-cache");
+    QScopedPointer<QSettings> cache;
+    if (useCache) {
+        QCryptographicHash module(QCryptographicHash::Sha1);
+        module.addData(QByteArray(hwc_module->id));
+        module.addData(QByteArray(hwc_module->name));
+        module.addData(QByteArray(hwc_module->author));
+        module.addData(QByteArray::number(hwc_module->module_api_version, 16));
+        module.addData(QByteArray::number(hwc_version, 16));
+        module.addData(halBuildFingerprint());
+
+        cache.reset(new QSettings(displayCachePath(), QSettings::IniFormat));
+        cache->beginGroup(QStringLiteral("%1-%2").arg(QLatin1String(module.result().toHex())).arg(config));
+    }
 
-    for (unsigned int i = 0; i < sizeof(attributes) / sizeof(uint32_t); i++) {
-        if (attributes[i] == attribute) {
-            return values[i];
+    if (cache && cache->contains(QLatin1String(displayAttributeNames[0]))) {
+        for (int i = 0; i < AttributeCount; ++i)
+            attributes[i] = cache->value(QLatin1String(displayAttributeNames[i])).toInt();
+    } else {
+        // All of them in one go
+        for (int i = 0; i < AttributeCount; ++i)
+            attributes[i] = 0;
+        const int result = hwc_device->getDisplayAttributes(hwc_device, display, config,
+                                                            displayAttributes, attributes);
+
+        // Nothing worth remembering if the query failed
+        if (cache && result == 0 && attributes[WidthAttribute] && attributes[HeightAttribute]) {
+            for (int i = 0; i < AttributeCount; ++i)
+                cache->setValue(QLatin1String(displayAttributeNames[i]), attributes[i]);
         }
     }
 
-    return 0;
+    m_attributesValid[display] = true;
+    return attributes;
 }
 
 float
 HwComposerBackend_v11::refreshRate()
 {
-    float value = (float)getSingleAttribute(HWC_DISPLAY_VSYNC_PERIOD);
+    return displayRefreshRate(HWC_DISPLAY_PRIMARY);
+}
+
+float
+HwComposerBackend_v11::displayRefreshRate(int display)
+{
+    if (display < HWC_DISPLAY_PRIMARY || display >= MaxDisplays || !m_connected[display])
+        return 60.0;
+
+    float value = (float)displayAttributeValues(display)[VSyncPeriodAttribute];
 
     value = (1000000000.0 / value);
 
@@ -452,14 +1206,25 @@ HwComposerBackend_v11::refreshRate()
 bool
 HwComposerBackend_v11::getScreenSizes(int *width, int *height, float *physical_width, float *physical_height)
 {
-    int dpi_x = getSingleAttribute(HWC_DISPLAY_DPI_X) / 1000;
-    int dpi_y = getSingleAttribute(HWC_DISPLAY_DPI_Y) / 1000;
+    return getDisplaySizes(HWC_DISPLAY_PRIMARY, width, height, physical_width, physical_height);
+}
+
+bool
+HwComposerBackend_v11::getDisplaySizes(int display, int *width, int *height, float *physical_width, float *physical_height)
+{
+    if (display < HWC_DISPLAY_PRIMARY || display >= MaxDisplays || !m_connected[display])
+        return false;
 
-    *width = getSingleAttribute(HWC_DISPLAY_WIDTH);
-    *height = getSingleAttribute(HWC_DISPLAY_HEIGHT);
+    const int32_t *values = displayAttributeValues(display);
+
+    int dpi_x = values[DpiXAttribute] / 1000;
+    int dpi_y = values[DpiYAttribute] / 1000;
+
+    *width = values[WidthAttribute];
+    *height = values[HeightAttribute];
 
     if (dpi_x == 0 || dpi_y == 0 || *width == 0 || *height == 0) {
-        qWarning() << "failed to read screen size from hwc1.x backend";
+        qWarning() << "failed to read size of display" << display << "from hwc1.x backend";
         return false;
     }
 
@@ -469,66 +1234,38 @@ HwComposerBackend_v11::getScreenSizes(int *width, int *height, float *physical_w
     return true;
 }
 
-void HwComposerBackend_v11::timerEvent(QTimerEvent *e)
+void HwComposerBackend_v11::onVSyncReceived(int display, int64_t timestamp)
 {
-    if (e->timerId() == m_vsyncTimeout.timerId()) {
-        hwc_device->eventControl(hwc_device, 0, HWC_EVENT_VSYNC, 0);
-        m_vsyncTimeout.stop();
-        // When waking up, we might get here as a result of requesting vsync events
-        // before the hwc is up and running. If we're timing out while still waiting
-        // for vsync to occur, trigger the update so we don't block the UI.
-        if (!m_pendingUpdate.isEmpty())
-            handleVSyncEvent();
-    } else if (e->timerId() == m_deliverUpdateTimeout.timerId()) {
-        m_deliverUpdateTimeout.stop();
-        handleVSyncEvent();
-    }
-}
+    if (display < HWC_DISPLAY_PRIMARY || display >= MaxDisplays)
+        return;
 
-bool HwComposerBackend_v11::event(QEvent *e)
-{
-    if (e->type() == QEvent::User) {
-        static int idleTime = qBound(5, qgetenv("QPA_HWC_IDLE_TIME").toInt(), 100);
-        if (!m_deliverUpdateTimeout.isActive())
-            m_deliverUpdateTimeout.start(idleTime, this);
-        return true;
-    }
-    return QObject::event(e);
-}
-
-void HwComposerBackend_v11::handleVSyncEvent()
-{
-    QSystraceEvent trace("graphics", "QPA::handleVsync");
-    QSet<QWindow *> pendingWindows = m_pendingUpdate;
-    m_pendingUpdate.clear();
-    foreach (QWindow *w, pendingWindows) {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 12, 0))
-        QPlatformWindow *platformWindow = w->handle();
-        if (!platformWindow)
-            continue;
-
-        platformWindow->deliverUpdateRequest();
-#else
-        QWindowPrivate *wp = (QWindowPrivate *) QWindowPrivate::get(w);
-        wp->deliverUpdateRequest();
-#endif
-    }
+    m_schedulers[display].postVSync(timestamp);
 }
 
 bool HwComposerBackend_v11::requestUpdate(QEglFSWindow *window)
 {
+    const int display = window->hwcDisplay();
+
     // If the display is off, do updates via the normal Qt-based timer.
-    if (m_displayOff)
+    if (display >= MaxDisplays || m_displayOff[display])
         return false;
 
-    if (m_vsyncTimeout.isActive()) {
-        m_vsyncTimeout.stop();
-    } else {
-        hwc_device->eventControl(hwc_device, 0, HWC_EVENT_VSYNC, 1);
-    }
-    m_vsyncTimeout.start(50, this);
-    m_pendingUpdate.insert(window->window());
+    m_schedulers[display].scheduleUpdate(window->window());
     return true;
 }
 
+void HwComposerBackend_v11::frameSwapped(QEglFSWindow *window)
+{
+    const int display = window->hwcDisplay();
+    if (display < MaxDisplays)
+        m_schedulers[display].frameSwapped(window->window());
+}
+
+void HwComposerBackend_v11::forgetWindow(QEglFSWindow *window)
+{
+    const int display = window->hwcDisplay();
+    if (display < MaxDisplays)
+        m_schedulers[display].forgetWindow(window->window());
+}
+
 #endif /* HWC_PLUGIN_HAVE_HWCOMPOSER1_API */
@@ -49,43 +49,94 @@
 // libhybris access to the native hwcomposer window
 #include <hwcomposer_window.h>
 
-#include <QBasicTimer>
+#include "hwcomposer_frame_scheduler.h"
+#include "hwcomposer_vsync_source.h"
 
 class HwcProcs_v11;
-class QWindow;
+class HwcComposition_v11;
+class HWComposer;
 
 class HwComposerBackend_v11 : public QObject, public HwComposerBackend {
 public:
+    // The primary and the external display, virtual displays would need
+    // an output buffer consumer
+    enum { MaxDisplays = HWC_DISPLAY_EXTERNAL + 1 };
+
     HwComposerBackend_v11(hw_module_t *hwc_module, hw_device_t *hw_device, void *libminisf, int num_displays);
     virtual ~HwComposerBackend_v11();
 
     virtual EGLNativeDisplayType display();
-    virtual EGLNativeWindowType createWindow(int width, int height);
+    virtual EGLNativeWindowType createWindow(int width, int height, int format);
     virtual void destroyWindow(EGLNativeWindowType window);
     virtual void swap(EGLNativeDisplayType display, EGLSurface surface);
+    virtual void swapWithDamage(EGLNativeDisplayType display, EGLSurface surface,
+                                EGLNativeWindowType window, const QRegion &damage) Q_DECL_OVERRIDE;
+    virtual void setFrameDamage(EGLNativeWindowType window, const QRegion &damage) Q_DECL_OVERRIDE;
     virtual void sleepDisplay(bool sleep);
     virtual float refreshRate();
     virtual bool getScreenSizes(int *width, int *height, float *physical_width, float *physical_height);
 
+    virtual void setDisplayListener(HwComposerDisplayListener *listener) Q_DECL_OVERRIDE;
+    virtual bool getDisplaySizes(int display, int *width, int *height, float *physical_width, float *physical_height) Q_DECL_OVERRIDE;
+    virtual float displayRefreshRate(int display) Q_DECL_OVERRIDE;
+    virtual EGLNativeWindowType createDisplayWindow(int display, int width, int height, int format) Q_DECL_OVERRIDE;
+    virtual void sleepExternalDisplay(int display, bool sleep) Q_DECL_OVERRIDE;
+
     virtual bool requestUpdate(QEglFSWindow *window) Q_DECL_OVERRIDE;
+    virtual void frameSwapped(QEglFSWindow *window) Q_DECL_OVERRIDE;
+    virtual void forgetWindow(QEglFSWindow *window) Q_DECL_OVERRIDE;
+
+    virtual bool supportsRasterBuffers() Q_DECL_OVERRIDE;
+
+    virtual bool supportsLayers() Q_DECL_OVERRIDE;
+    virtual EGLNativeWindowType createLayerWindow(int display, int width, int height, int format) Q_DECL_OVERRIDE;
+    virtual void setLayerState(EGLNativeWindowType window, const HwComposerLayerState &state) Q_DECL_OVERRIDE;
+
+    virtual bool scanoutBuffer(ANativeWindowBuffer *buffer, int *displayedFenceFd) Q_DECL_OVERRIDE;
+    virtual int endScanout() Q_DECL_OVERRIDE;
 
-    void timerEvent(QTimerEvent *) Q_DECL_OVERRIDE;
-    void handleVSyncEvent();
-    bool event(QEvent *e) Q_DECL_OVERRIDE;
+    // Called from the hwcomposer callback threads
+    void onVSyncReceived(int display, int64_t timestamp);
+    void onHotplug(int display, bool connected);
+
+protected:
+    void customEvent(QEvent *e) Q_DECL_OVERRIDE;
 
 private:
-    int getSingleAttribute(uint32_t attribute);
+    enum DisplayAttribute {
+        VSyncPeriodAttribute,
+        WidthAttribute,
+        HeightAttribute,
+        DpiXAttribute,
+        DpiYAttribute,
+        AttributeCount
+    };
+
+    uint32_t activeConfig(int display);
+    // Attributes of the active config of a display, queried once per
+    // connection, indexed by DisplayAttribute
+    const int32_t *displayAttributeValues(int display);
+
+    void handleHotplug(int display, bool connected);
+    void setDisplayPower(int display, bool on);
+    void setPowerMode(int display, bool on);
+
     hwc_composer_device_1_t *hwc_device;
-    hwc_display_contents_1_t *hwc_list;
-    hwc_display_contents_1_t **hwc_mList;
     uint32_t hwc_version;
     int num_displays;
+    HwcComposition_v11 *m_composition;
+    HWComposer *m_primaryWindow;
+    HwComposerDisplayListener *m_displayListener;
 
-    bool m_displayOff;
-    QBasicTimer m_deliverUpdateTimeout;
-    QBasicTimer m_vsyncTimeout;
-    QSet<QWindow *> m_pendingUpdate;
+    // Indexed by HWC_DISPLAY_*, vsync events arrive per display
+    bool m_connected[MaxDisplays];
+    bool m_displayOff[MaxDisplays];
+    HwComposerVSyncSource *m_vsyncSources[MaxDisplays];
+    HwComposerFrameScheduler m_schedulers[MaxDisplays];
     HwcProcs_v11 *procs;
+
+    int32_t m_attributes[MaxDisplays][AttributeCount + 1];
+    bool m_attributesValid[MaxDisplays];
 };
 
 #endif /* HWC_PLUGIN_HAVE_HWCOMPOSER1_API */
@@ -42,12 +42,15 @@
 #include <android-version.h>
 #include "hwcomposer_backend_v20.h"
 #include "qeglfswindow.h"
+#include "hwcomposer_fence_policy.h"
+#include "hwcomposer_stats.h"
 
 #include <string>
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QTimerEvent>
 #include <QtCore/QCoreApplication>
-#include <private/qwindow_p.h>
+#include <QtCore/QMutex>
+#include <QtCore/QVarLengthArray>
 
 #include "qsystrace_selector.h"
 
@@ -55,19 +58,6 @@
 
 // #ifdef HWC_PLUGIN_HAVE_HWCOMPOSER1_API
 
-// #define QPA_HWC_TIMING
-
-#ifdef QPA_HWC_TIMING
-#define QPA_HWC_TIMING_SAMPLE(variable) variable = timer.nsecsElapsed()
-static QElapsedTimer timer;
-static qint64 presentTime;
-static qint64 syncTime;
-static qint64 prepareTime;
-static qint64 setTime;
-#else
-#define QPA_HWC_TIMING_SAMPLE(variable)
-#endif
-
 struct HwcProcs_v20 : public HWC2EventListener
 {
     HwComposerBackend_v20 *backend;
@@ -83,8 +73,7 @@ void hwc2_callback_vsync(HWC2EventListener* listener, int32_t sequenceId,
     else
         QSystrace::end("graphics", "QPA::vsync", "");
 
-    QCoreApplication::postEvent(static_cast<const HwcProcs_v20 *>(listener)->backend,
-                                new QEvent(QEvent::User));
+    static_cast<const HwcProcs_v20 *>(listener)->backend->onVSyncReceived(timestamp);
 }
 
 void hwc2_callback_hotplug(HWC2EventListener* listener, int32_t sequenceId,
@@ -103,31 +92,123 @@ void hwc2_callback_hotplug(HWC2EventListener* listener, int32_t sequenceId,
 void hwc2_callback_refresh(HWC2EventListener* listener, int32_t sequenceId,
                            hwc2_display_t display)
 {
+    // The display asks for its whole state to be sent again
+    static_cast<const HwcProcs_v20 *>(listener)->backend->invalidateComposition();
 }
 
-class HWC2Window : public HWComposerNativeWindow
+class HwcVSyncSource_v20 : public HwComposerVSyncSource
 {
+public:
+    HwcVSyncSource_v20(hwc2_compat_display_t *display)
+        : hwc2_display(display)
+    {
+    }
+
+protected:
+    void setHardwareVSyncEnabled(bool enabled) Q_DECL_OVERRIDE
+    {
+        hwc2_compat_display_set_vsync_enabled(hwc2_display,
+            enabled ? HWC2_VSYNC_ENABLE : HWC2_VSYNC_DISABLE);
+    }
+
+private:
+    hwc2_compat_display_t *hwc2_display;
+};
+
+class HwcComposition_v20;
+
+class HWC2Window : public HWComposerNativeWindow, public HwComposerPresentThread::Target
+{
+    friend class HwcComposition_v20;
+    friend class HwComposerBackend_v20;
     private:
+        HwcComposition_v20 *composition;
+        // The client layer for the primary window, otherwise a device
+        // layer that only exists while the window is visible
         hwc2_compat_layer_t *layer;
-        hwc2_compat_display_t *hwcDisplay;
+        HwComposerPresentThread *presentThread;
         int lastPresentFence = -1;
-        bool m_syncBeforeSet;
+        int m_bufferCount;
+        HWComposerNativeWindowBuffer *m_front;
+        HwComposerLayerState m_state;
+        // Damage of the frame being swapped, empty means everything
+        QRegion m_swapDamage;
     protected:
         void present(HWComposerNativeWindowBuffer *buffer);
+        int dequeueBuffer(BaseNativeWindowBuffer **buffer, int *fenceFd);
 
     public:
 
         HWC2Window(unsigned int width, unsigned int height, unsigned int format,
-                hwc2_compat_display_t *display, hwc2_compat_layer_t *layer);
+                HwcComposition_v20 *composition, hwc2_compat_layer_t *layer,
+                HwComposerPresentThread *presentThread);
         ~HWC2Window();
         void set();
+
+        int commit(HWComposerNativeWindowBuffer *buffer, int acquireFenceFd, const QRegion &damage) Q_DECL_OVERRIDE;
+};
+
+// Everything shown on the primary display. The fullscreen window is the
+// client target, every other window gets a device layer on top of it.
+// Presenting any window presents the whole display, so that happens under
+// one lock.
+class HwcComposition_v20
+{
+public:
+    HwcComposition_v20(hwc2_compat_display_t *display, float refreshRate);
+
+    void addWindow(HWC2Window *window, bool primary);
+    void removeWindow(HWC2Window *window);
+    void setLayerState(HWC2Window *window, const HwComposerLayerState &state);
+    void setEnabled(bool enabled);
+
+    // Makes the next frame validate the display state again
+    void invalidate() { m_stateGeneration.ref(); }
+
+    int commit(HWC2Window *window, HWComposerNativeWindowBuffer *buffer, int acquireFenceFd, const QRegion &damage);
+
+    bool scanout(ANativeWindowBuffer *buffer, int *displayedFenceFd);
+    int endScanout();
+
+    // True once a window layer had to be left to client composition
+    bool layersRefused() { return m_compositionRefused.load() != 0; }
+
+private:
+    void setClientTarget(HWComposerNativeWindowBuffer *buffer, int acquireFenceFd);
+    hwc2_error_t presentDisplay(int *presentFence);
+    void updateLayer(HWC2Window *window);
+    int refresh();
+
+    QMutex m_mutex;
+    hwc2_compat_display_t *hwcDisplay;
+    QRect m_screen;
+    HWC2Window *m_primary;
+    QList<HWC2Window *> m_layers;
+    bool m_enabled;
+    // Set from the presenting thread, read when windows are created
+    QAtomicInt m_compositionRefused;
+    // Device layer showing a client buffer fullscreen
+    hwc2_compat_layer_t *m_scanoutLayer;
+    QSize m_scanoutSize;
+    bool m_scanoutRefused;
+    HwComposerFencePolicy m_fencePolicy;
+    QAtomicInt m_stateGeneration;
+    int m_validatedGeneration;
+    bool m_skipValidate;
+    // hwc2_compat does not tell whether the device has
+    // HWC2_CAPABILITY_SKIP_VALIDATE, the first present without validate
+    // does instead
+    bool m_skipValidateProbed;
 };
 
 HWC2Window::HWC2Window(unsigned int width, unsigned int height,
-                    unsigned int format, hwc2_compat_display_t* display,
-                    hwc2_compat_layer_t *layer) :
+                    unsigned int format, HwcComposition_v20 *composition,
+                    hwc2_compat_layer_t *layer,
+                    HwComposerPresentThread *presentThread) :
                     HWComposerNativeWindow(width, height, format),
-                    layer(layer), hwcDisplay(display)
+                    composition(composition), layer(layer),
+                    presentThread(presentThread),
+                    m_front(NULL)
 {
     int bufferCount = qgetenv("QPA_HWC_BUFFER_COUNT").toInt();
     if (bufferCount)
@@ -136,77 +217,433 @@ HWC2Window::HWC2Window(unsigned int width, unsigned int height,
         // default to triple-buffering as on Android
         bufferCount = 3;
     setBufferCount(bufferCount);
-    m_syncBeforeSet = qEnvironmentVariableIsSet("QPA_HWC_SYNC_BEFORE_SET");
+    m_bufferCount = bufferCount;
 }
 
 HWC2Window::~HWC2Window()
 {
+    if (presentThread)
+        presentThread->waitForCommitted(0);
+
     if (lastPresentFence != -1) {
         close(lastPresentFence);
     }
 }
 
+int HWC2Window::dequeueBuffer(BaseNativeWindowBuffer **buffer, int *fenceFd)
+{
+    // Buffers are handed out in FIFO order, so the next one was queued
+    // bufferCount - 1 frames ago. Its release fence is only known once the
+    // present thread has committed it.
+    HwComposerStats::Timer timer;
+    if (presentThread)
+        presentThread->waitForCommitted(m_bufferCount - 2);
+
+    int ret = HWComposerNativeWindow::dequeueBuffer(buffer, fenceFd);
+    timer.lap(HwComposerStats::Dequeue);
+    return ret;
+}
+
 void HWC2Window::present(HWComposerNativeWindowBuffer *buffer)
+{
+    QSystraceEvent trace("graphics", "QPA::present");
+
+    int acquireFenceFd = getFenceBufferFd(buffer);
+    const QRegion damage = m_swapDamage;
+    m_swapDamage = QRegion();
+
+    if (presentThread) {
+        presentThread->queue(this, buffer, acquireFenceFd, damage);
+        return;
+    }
+
+    int presentFence = commit(buffer, acquireFenceFd, damage);
+
+    if (lastPresentFence != -1) {
+        HwComposerStats::Timer timer;
+        sync_wait(lastPresentFence, -1);
+        timer.lap(HwComposerStats::RetireFenceWait);
+        close(lastPresentFence);
+    }
+
+    lastPresentFence = presentFence;
+}
+
+int HWC2Window::commit(HWComposerNativeWindowBuffer *buffer, int acquireFenceFd, const QRegion &damage)
+{
+    return composition->commit(this, buffer, acquireFenceFd, damage);
+}
+
+HwcComposition_v20::HwcComposition_v20(hwc2_compat_display_t *display, float refreshRate)
+    : hwcDisplay(display)
+    , m_primary(NULL)
+    , m_enabled(true)
+    , m_compositionRefused(0)
+    , m_scanoutLayer(NULL)
+    , m_scanoutRefused(false)
+    // Presenting always waits for the previous present fence, only
+    // waiting for the acquire fence is optional here
+    , m_fencePolicy(HwComposerFencePolicy::SyncBeforeSet, refreshRate)
+    , m_stateGeneration(0)
+    , m_validatedGeneration(-1)
+    , m_skipValidateProbed(false)
+{
+    m_skipValidate = !qgetenv("QPA_HWC_WORKAROUNDS").split(',').contains("no-skip-validate");
+}
+
+void HwcComposition_v20::addWindow(HWC2Window *window, bool primary)
+{
+    QMutexLocker lock(&m_mutex);
+
+    if (primary) {
+        m_primary = window;
+        m_screen = QRect(0, 0, window->width(), window->height());
+    } else {
+        m_layers.append(window);
+    }
+    invalidate();
+}
+
+void HwcComposition_v20::removeWindow(HWC2Window *window)
+{
+    QMutexLocker lock(&m_mutex);
+
+    if (window == m_primary) {
+        m_primary = NULL;
+        return;
+    }
+
+    if (!m_layers.removeOne(window))
+        return;
+
+    if (window->layer) {
+        hwc2_compat_display_destroy_layer(hwcDisplay, window->layer);
+        window->layer = NULL;
+        invalidate();
+
+        // Take the layer off the screen before its buffers go away
+        int presentFence = refresh();
+        if (presentFence != -1) {
+            sync_wait(presentFence, 1000);
+            close(presentFence);
+        }
+    }
+}
+
+void HwcComposition_v20::setLayerState(HWC2Window *window, const HwComposerLayerState &state)
+{
+    QMutexLocker lock(&m_mutex);
+
+    window->m_state = state;
+
+    if (state.visible && !window->layer) {
+        window->layer = hwc2_compat_display_create_layer(hwcDisplay);
+        hwc2_compat_layer_set_composition_type(window->layer, HWC2_COMPOSITION_DEVICE);
+        hwc2_compat_layer_set_blend_mode(window->layer, HWC2_BLEND_MODE_PREMULTIPLIED);
+        if (window->m_front)
+            hwc2_compat_layer_set_buffer(window->layer, /* slot */0, window->m_front, -1);
+    } else if (!state.visible && window->layer) {
+        hwc2_compat_display_destroy_layer(hwcDisplay, window->layer);
+        window->layer = NULL;
+    }
+
+    if (window->layer)
+        updateLayer(window);
+
+    invalidate();
+}
+
+void HwcComposition_v20::updateLayer(HWC2Window *window)
+{
+    // Clip to the screen, cropping the buffer to match
+    const QRect geometry = window->m_state.geometry;
+    const QRect frame = geometry & m_screen;
+    const QRect crop = frame.translated(-geometry.topLeft())
+        & QRect(0, 0, window->width(), window->height());
+
+    hwc2_compat_layer_set_source_crop(window->layer, crop.left(), crop.top(),
+                                      crop.right() + 1, crop.bottom() + 1);
+    hwc2_compat_layer_set_display_frame(window->layer, frame.left(), frame.top(),
+                                        frame.right() + 1, frame.bottom() + 1);
+    hwc2_compat_layer_set_visible_region(window->layer, frame.left(), frame.top(),
+                                         frame.right() + 1, frame.bottom() + 1);
+    hwc2_compat_layer_set_plane_alpha(window->layer, window->m_state.opacity);
+#ifdef HWC_PLUGIN_HAVE_HWC2_LAYER_Z_ORDER
+    hwc2_compat_layer_set_z_order(window->layer, window->m_state.z);
+#endif
+}
+
+void HwcComposition_v20::setEnabled(bool enabled)
+{
+    QMutexLocker lock(&m_mutex);
+
+    m_enabled = enabled;
+    invalidate();
+}
+
+void HwcComposition_v20::setClientTarget(HWComposerNativeWindowBuffer *buffer, int acquireFenceFd)
+{
+    QSystrace::begin("graphics", "QPA::set_client_target", "");
+    hwc2_compat_display_set_client_target(hwcDisplay, /* slot */0, buffer,
+                                          acquireFenceFd,
+                                          HAL_DATASPACE_UNKNOWN);
+    QSystrace::end("graphics", "QPA::set_client_target", "");
+}
+
+hwc2_error_t HwcComposition_v20::presentDisplay(int *presentFence)
+{
+    QSystrace::begin("graphics", "QPA::present", "");
+    hwc2_error_t error = hwc2_compat_display_present(hwcDisplay, presentFence);
+    QSystrace::end("graphics", "QPA::present", "");
+    return error;
+}
+
+int HwcComposition_v20::refresh()
+{
+    if (!m_enabled || !m_primary || !m_primary->m_front)
+        return -1;
+
+    uint32_t numTypes = 0;
+    uint32_t numRequests = 0;
+    hwc2_error_t error = hwc2_compat_display_validate(hwcDisplay, &numTypes, &numRequests);
+    if (error != HWC2_ERROR_NONE && error != HWC2_ERROR_HAS_CHANGES)
+        return -1;
+
+    if (hwc2_compat_display_accept_changes(hwcDisplay) != HWC2_ERROR_NONE)
+        return -1;
+
+    m_validatedGeneration = m_stateGeneration.load();
+
+    int presentFence = -1;
+    presentDisplay(&presentFence);
+    return presentFence;
+}
+
+bool HwcComposition_v20::scanout(ANativeWindowBuffer *buffer, int *displayedFenceFd)
+{
+    QMutexLocker lock(&m_mutex);
+
+    if (!m_enabled || !m_primary || !m_primary->m_front || m_scanoutRefused)
+        return false;
+
+    if (!m_scanoutLayer) {
+        m_scanoutLayer = hwc2_compat_display_create_layer(hwcDisplay);
+        hwc2_compat_layer_set_composition_type(m_scanoutLayer, HWC2_COMPOSITION_DEVICE);
+        hwc2_compat_layer_set_blend_mode(m_scanoutLayer, HWC2_BLEND_MODE_NONE);
+        hwc2_compat_layer_set_display_frame(m_scanoutLayer, 0, 0, m_screen.width(), m_screen.height());
+        hwc2_compat_layer_set_visible_region(m_scanoutLayer, 0, 0, m_screen.width(), m_screen.height());
+#ifdef HWC_PLUGIN_HAVE_HWC2_LAYER_Z_ORDER
+        hwc2_compat_layer_set_z_order(m_scanoutLayer, 1);
+#endif
+        m_scanoutSize = QSize();
+        invalidate();
+    }
+
+    // The whole buffer is scaled to the screen, whatever its size
+    const QSize size(buffer->width, buffer->height);
+    if (size != m_scanoutSize) {
+        hwc2_compat_layer_set_source_crop(m_scanoutLayer, 0.0f, 0.0f, size.width(), size.height());
+        m_scanoutSize = size;
+        invalidate();
+    }
+
+    // Client buffers are complete by the time they are handed over
+    hwc2_compat_layer_set_buffer(m_scanoutLayer, /* slot */0, buffer, -1);
+
+    uint32_t numTypes = 0;
+    uint32_t numRequests = 0;
+    hwc2_error_t error = hwc2_compat_display_validate(hwcDisplay, &numTypes, &numRequests);
+    if ((error != HWC2_ERROR_NONE && error != HWC2_ERROR_HAS_CHANGES) || numTypes) {
+        // Most likely the layer would need client composition
+        qDebug("QPA-HWC: display can not show client buffers directly, using GL composition");
+        hwc2_compat_display_destroy_layer(hwcDisplay, m_scanoutLayer);
+        m_scanoutLayer = NULL;
+        m_scanoutRefused = true;
+        invalidate();
+        return false;
+    }
+
+    hwc2_compat_display_accept_changes(hwcDisplay);
+    m_validatedGeneration = m_stateGeneration.load();
+
+    *displayedFenceFd = -1;
+    presentDisplay(displayedFenceFd);
+    return true;
+}
+
+int HwcComposition_v20::endScanout()
+{
+    QMutexLocker lock(&m_mutex);
+
+    // A later buffer may fit where this one did not
+    m_scanoutRefused = false;
+
+    if (!m_scanoutLayer)
+        return -1;
+
+    hwc2_compat_display_destroy_layer(hwcDisplay, m_scanoutLayer);
+    m_scanoutLayer = NULL;
+    invalidate();
+
+    return refresh();
+}
+
+int HwcComposition_v20::commit(HWC2Window *window, HWComposerNativeWindowBuffer *buffer, int acquireFenceFd, const QRegion &damage)
 {
     uint32_t numTypes = 0;
     uint32_t numRequests = 0;
     int displayId = 0;
     hwc2_error_t error = HWC2_ERROR_NONE;
 
-    QSystraceEvent trace("graphics", "QPA::present");
+    QSystraceEvent trace("graphics", "QPA::commit");
 
-    QPA_HWC_TIMING_SAMPLE(presentTime);
+    QMutexLocker lock(&m_mutex);
 
-    int acquireFenceFd = getFenceBufferFd(buffer);
+    const int policy = m_fencePolicy.beginFrame();
 
-    if (m_syncBeforeSet && acquireFenceFd >= 0) {
+    HwComposerStats::Timer timer;
+    if ((policy & HwComposerFencePolicy::SyncBeforeSet) && acquireFenceFd >= 0) {
         sync_wait(acquireFenceFd, -1);
         close(acquireFenceFd);
         acquireFenceFd = -1;
+        timer.lap(HwComposerStats::AcquireFenceWait);
+    }
+
+    timer.restart();
+
+    window->m_front = buffer;
+
+    // Layer buffers are part of the state that gets validated, so they go
+    // to the display before anything else
+    const bool primary = window == m_primary;
+    if (!primary) {
+        if (!window->layer) {
+            // Hidden, the buffer is free once rendering has finished
+            window->setFenceBufferFd(buffer, acquireFenceFd);
+            return -1;
+        }
+
+        // The layer owns the acquire fence now, a copy is kept in case
+        // the frame fails and the buffer has to be released right away
+        const int layerFenceFd = acquireFenceFd;
+        acquireFenceFd = layerFenceFd != -1 ? dup(layerFenceFd) : -1;
+        hwc2_compat_layer_set_buffer(window->layer, /* slot */0, buffer, layerFenceFd);
+#ifdef HWC_PLUGIN_HAVE_HWC2_SURFACE_DAMAGE
+        // Takes a single rectangle in buffer coordinates, an empty one
+        // would mean nothing changed
+        const QRect bufferRect(0, 0, window->width(), window->height());
+        QRect bounds = damage.boundingRect() & bufferRect;
+        if (bounds.isEmpty())
+            bounds = bufferRect;
+        hwc2_compat_layer_set_surface_damage(window->layer, bounds.left(), bounds.top(),
+                                             bounds.right() + 1, bounds.bottom() + 1);
+#else
+        Q_UNUSED(damage);
+#endif
+
+        // Layers wait for the primary window to be shown underneath them
+        if (!m_primary || !m_primary->m_front) {
+            if (acquireFenceFd != -1)
+                close(acquireFenceFd);
+            return -1;
+        }
+    }
+
+    // Only buffers change from frame to frame, so as long as the display
+    // state is the one validated last, present right away like
+    // SurfaceFlinger's presentOrValidate. The display answers
+    // HWC2_ERROR_NOT_VALIDATED when it needs a validate after all.
+    const int generation = m_stateGeneration.load();
+    bool clientTargetSet = !primary;
+    if (m_skipValidate && generation == m_validatedGeneration) {
+        if (primary) {
+            // The display owns the acquire fence now, as for layers a copy
+            // is kept for when the buffer is released without a present
+            const int clientFenceFd = acquireFenceFd;
+            acquireFenceFd = clientFenceFd != -1 ? dup(clientFenceFd) : -1;
+            setClientTarget(buffer, clientFenceFd);
+            clientTargetSet = true;
+        }
+
+        int presentFence = -1;
+        error = presentDisplay(&presentFence);
+        if (error == HWC2_ERROR_NONE) {
+            m_skipValidateProbed = true;
+            timer.lap(HwComposerStats::Present);
+            if (acquireFenceFd != -1)
+                close(acquireFenceFd);
+            window->setFenceBufferFd(buffer, presentFence);
+            m_fencePolicy.endFrame(primary, presentFence);
+            return presentFence != -1 ? dup(presentFence) : -1;
+        }
+
+        if (error != HWC2_ERROR_NOT_VALIDATED) {
+            qDebug("present: present failed for display %d: %d", displayId, error);
+            // Not shown, free once rendering into it has finished
+            window->setFenceBufferFd(buffer, acquireFenceFd);
+            return -1;
+        }
+
+        // A device with HWC2_CAPABILITY_SKIP_VALIDATE presents a state it
+        // validated before, it may still ask for a validate later on
+        if (!m_skipValidateProbed) {
+            qDebug("QPA-HWC: display %d can not present without validate, no longer skipping it", displayId);
+            m_skipValidate = false;
+            m_skipValidateProbed = true;
+        }
     }
 
     error = hwc2_compat_display_validate(hwcDisplay, &numTypes,
                                                     &numRequests);
     if (error != HWC2_ERROR_NONE && error != HWC2_ERROR_HAS_CHANGES) {
         qDebug("prepare: validate failed for display %d: %d", displayId, error);
-        return;
+        // The buffer was not handed to the display, it is free to be
+        // reused as soon as rendering to it has finished.
+        window->setFenceBufferFd(buffer, acquireFenceFd);
+        return -1;
     }
 
     if (numTypes || numRequests) {
-        qDebug("prepare: validate required changes for display %d: %d",
-               displayId, error);
-        return;
+        if (m_layers.isEmpty()) {
+            qDebug("prepare: validate required changes for display %d: %d",
+                   displayId, error);
+            window->setFenceBufferFd(buffer, acquireFenceFd);
+            return -1;
+        }
+
+        // Layers moved to client composition would have to be drawn into
+        // the client target, which only holds the primary window
+        if (m_compositionRefused.testAndSetRelaxed(0, 1)) {
+            qWarning("QPA-HWC: display %d can not compose every window layer, %u will not be visible "
+                     "and no more windows are made layers", displayId, numTypes);
+        }
     }
 
     error = hwc2_compat_display_accept_changes(hwcDisplay);
     if (error != HWC2_ERROR_NONE) {
         qDebug("prepare: acceptChanges failed: %d", error);
-        return;
+        window->setFenceBufferFd(buffer, acquireFenceFd);
+        return -1;
     }
 
-    QPA_HWC_TIMING_SAMPLE(prepareTime);
+    m_validatedGeneration = generation;
 
-    QSystrace::begin("graphics", "QPA::set_client_target", "");
-    hwc2_compat_display_set_client_target(hwcDisplay, /* slot */0, buffer,
-                                          acquireFenceFd,
-                                          HAL_DATASPACE_UNKNOWN);
-    QSystrace::end("graphics", "QPA::set_client_target", "");
+    timer.lap(HwComposerStats::Prepare);
 
-    QSystrace::begin("graphics", "QPA::present", "");
-    int presentFence = -1;
-    hwc2_compat_display_present(hwcDisplay, &presentFence);
-    QSystrace::end("graphics", "QPA::present", "");
+    if (!clientTargetSet)
+        setClientTarget(buffer, acquireFenceFd);
+    else if (acquireFenceFd != -1)
+        close(acquireFenceFd);
 
-    QPA_HWC_TIMING_SAMPLE(setTime);
+    int presentFence = -1;
+    presentDisplay(&presentFence);
+    timer.lap(HwComposerStats::Present);
 
-    if (lastPresentFence != -1) {
-        sync_wait(lastPresentFence, -1);
-        close(lastPresentFence);
-    }
+    window->setFenceBufferFd(buffer, presentFence);
 
-    lastPresentFence = presentFence != -1 ? dup(presentFence) : -1;
+    m_fencePolicy.endFrame(primary, presentFence);
 
-    setFenceBufferFd(buffer, presentFence);
+    return presentFence != -1 ? dup(presentFence) : -1;
 }
 
 int HwComposerBackend_v20::composerSequenceId = 0;
@@ -216,7 +653,12 @@ HwComposerBackend_v20::HwComposerBackend_v20(hw_module_t *hwc_module, void *libm
     , hwc2_device(NULL)
     , hwc2_primary_display(NULL)
     , hwc2_primary_layer(NULL)
-    , m_displayOff(true)
+    , m_displayOff(1)
+    , m_vsyncSource(NULL)
+    , m_presentThread(NULL)
+    , m_composition(NULL)
+    , m_primaryWindow(NULL)
+    , m_displayReady(0)
 {
     procs = new HwcProcs_v20();
     procs->on_vsync_received = hwc2_callback_vsync;
@@ -230,20 +672,72 @@ HwComposerBackend_v20::HwComposerBackend_v20(hw_module_t *hwc_module, void *libm
     hwc2_compat_device_register_callback(hwc2_device, procs,
         HwComposerBackend_v20::composerSequenceId++);
 
-    for (int i = 0; i < 5 * 1000; ++i) {
-        // Wait at most 5s for hotplug events
-        if ((hwc2_primary_display =
-            hwc2_compat_device_get_display_by_id(hwc2_device, 0)))
-            break;
-        usleep(1000);
+    // The primary display comes with a hotplug event, which may take a
+    // while. Everything that needs it waits in waitForDisplay(), so that
+    // EGL and the rest of Qt can get ready until then.
+}
+
+void HwComposerBackend_v20::waitForDisplay()
+{
+    if (m_displayReady.loadAcquire())
+        return;
+
+    QMutexLocker initLock(&m_initMutex);
+    if (m_displayReady.load())
+        return;
+
+    // Wait at most 5s for hotplug events
+    QElapsedTimer timer;
+    timer.start();
+    {
+        QMutexLocker lock(&m_hotplugMutex);
+        while (!(hwc2_primary_display =
+                 hwc2_compat_device_get_display_by_id(hwc2_device, 0))) {
+            const qint64 remaining = 5000 - timer.elapsed();
+            if (remaining <= 0)
+                break;
+            m_hotplugCondition.wait(&m_hotplugMutex, remaining);
+        }
     }
     HWC_PLUGIN_ASSERT_NOT_NULL(hwc2_primary_display);
+    qDebug("QPA-HWC: primary display after %lld ms", timer.elapsed());
 
-    sleepDisplay(false);
+    // Other callers keep waiting until everything is set up
+    initDisplay();
+    m_displayReady.storeRelease(1);
+}
+
+void HwComposerBackend_v20::initDisplay()
+{
+    const float rate = activeRefreshRate();
+
+    // Render threads can get here first, the vsync source and the present
+    // thread belong to the GUI thread like the backend itself
+    m_vsyncSource = new HwcVSyncSource_v20(hwc2_primary_display);
+    m_vsyncSource->moveToThread(thread());
+    m_scheduler.setVSyncSource(m_vsyncSource);
+    m_scheduler.setRefreshRate(rate);
+
+    m_composition = new HwcComposition_v20(hwc2_primary_display, rate);
+
+    // QPA_HWC_SYNC_PRESENT keeps presentation and fence waits inside
+    // eglSwapBuffers on the render thread.
+    if (!qEnvironmentVariableIsSet("QPA_HWC_SYNC_PRESENT")) {
+        m_presentThread = new HwComposerPresentThread;
+        m_presentThread->moveToThread(thread());
+    }
+
+    setDisplayPower(true);
 }
 
 HwComposerBackend_v20::~HwComposerBackend_v20()
 {
+    waitForDisplay();
+
+    // Let queued frames reach the display before tearing it down
+    delete m_presentThread;
+    delete m_composition;
+
     hwc2_compat_display_set_vsync_enabled(hwc2_primary_display, HWC2_VSYNC_DISABLE);
 
     hwc2_compat_display_set_power_mode(hwc2_primary_display, HWC2_POWER_MODE_DOZE);
@@ -256,6 +750,8 @@ HwComposerBackend_v20::~HwComposerBackend_v20()
         free(hwc2_primary_display);
     }
 
+    m_scheduler.setVSyncSource(NULL);
+    delete m_vsyncSource;
     delete procs;
 }
 
@@ -266,8 +762,10 @@ HwComposerBackend_v20::display()
 }
 
 EGLNativeWindowType
-HwComposerBackend_v20::createWindow(int width, int height)
+HwComposerBackend_v20::createWindow(int width, int height, int format)
 {
+    waitForDisplay();
+
     // We expect that we haven't created a window already, if we had, we
     // would leak stuff, and we want to avoid that for obvious reasons.
     HWC_PLUGIN_EXPECT_NULL(hwc2_primary_layer);
@@ -280,64 +778,163 @@ HwComposerBackend_v20::createWindow(int width, int height)
     hwc2_compat_layer_set_source_crop(layer, 0.0f, 0.0f, width, height);
     hwc2_compat_layer_set_display_frame(layer, 0, 0, width, height);
     hwc2_compat_layer_set_visible_region(layer, 0, 0, width, height);
+#ifdef HWC_PLUGIN_HAVE_HWC2_LAYER_Z_ORDER
+    hwc2_compat_layer_set_z_order(layer, 0);
+#endif
 
     HWC2Window *hwc_win = new HWC2Window(width, height,
-                                         HAL_PIXEL_FORMAT_RGBA_8888,
-                                         hwc2_primary_display, layer);
+                                         format,
+                                         m_composition, layer,
+                                         m_presentThread);
+    m_composition->addWindow(hwc_win, true);
+    m_primaryWindow = hwc_win;
+
+    return (EGLNativeWindowType) static_cast<ANativeWindow *>(hwc_win);
+}
+
+EGLNativeWindowType
+HwComposerBackend_v20::createLayerWindow(int display, int width, int height, int format)
+{
+    // Only the primary display is driven, no other display is announced
+    Q_UNUSED(display);
+
+    waitForDisplay();
+
+    // The backend holds a reference until destroyWindow(), an EGL surface
+    // holds another while it exists
+    HWC2Window *hwc_win = new HWC2Window(width, height,
+                                         format,
+                                         m_composition, NULL,
+                                         m_presentThread);
+    hwc_win->common.incRef(&hwc_win->common);
+    m_composition->addWindow(hwc_win, false);
 
     return (EGLNativeWindowType) static_cast<ANativeWindow *>(hwc_win);
 }
 
+void
+HwComposerBackend_v20::setLayerState(EGLNativeWindowType window, const HwComposerLayerState &state)
+{
+    HWC2Window *hwc_win = static_cast<HWC2Window *>((ANativeWindow *) window);
+    m_composition->setLayerState(hwc_win, state);
+}
+
+bool
+HwComposerBackend_v20::supportsRasterBuffers()
+{
+    return true;
+}
+
+bool
+HwComposerBackend_v20::supportsLayers()
+{
+    // Windows the hwcomposer can not compose would stay invisible, later
+    // ones are drawn with the fullscreen window instead
+    waitForDisplay();
+    return !m_composition->layersRefused();
+}
+
+bool
+HwComposerBackend_v20::scanoutBuffer(ANativeWindowBuffer *buffer, int *displayedFenceFd)
+{
+    waitForDisplay();
+    return m_composition->scanout(buffer, displayedFenceFd);
+}
+
+int
+HwComposerBackend_v20::endScanout()
+{
+    waitForDisplay();
+    return m_composition->endScanout();
+}
+
 void
 HwComposerBackend_v20::destroyWindow(EGLNativeWindowType window)
 {
-    Q_UNUSED(window);
+    HWC2Window *hwc_win = static_cast<HWC2Window *>((ANativeWindow *) window);
+
+    // The primary window lives as long as the backend
+    if (hwc_win == m_primaryWindow)
+        return;
+
+    // Frames of the window still queued for presentation use its layer
+    if (m_presentThread)
+        m_presentThread->waitForCommitted(0);
+
+    // Off screen once this returns, the window and its buffers go with
+    // the last reference
+    m_composition->removeWindow(hwc_win);
+    hwc_win->common.decRef(&hwc_win->common);
 }
 
 void
 HwComposerBackend_v20::swap(EGLNativeDisplayType display, EGLSurface surface)
 {
-#ifdef QPA_HWC_TIMING
-    timer.start();
-#endif
-
     eglSwapBuffers(display, surface);
+}
 
-#ifdef QPA_HWC_TIMING
-    qDebug("HWComposerBackend::swap(), present=%.3f, sync=%.3f, prepare=%.3f, set=%.3f, total=%.3f",
-           presentTime / 1000000.0,
-           (syncTime - presentTime) / 1000000.0,
-           (prepareTime - syncTime) / 1000000.0,
-           (setTime - prepareTime) / 1000000.0,
-           timer.nsecsElapsed() / 1000000.0);
-#endif
+void
+HwComposerBackend_v20::swapWithDamage(EGLNativeDisplayType display, EGLSurface surface,
+                                      EGLNativeWindowType window, const QRegion &damage)
+{
+    // The window is presented from within eglSwapBuffers on this thread
+    setFrameDamage(window, damage);
+    swapBuffersWithDamage(display, surface, damage);
+}
+
+void
+HwComposerBackend_v20::setFrameDamage(EGLNativeWindowType window, const QRegion &damage)
+{
+    HWC2Window *hwc_win = static_cast<HWC2Window *>((ANativeWindow *) window);
+    hwc_win->m_swapDamage = damage;
 }
 
 void
 HwComposerBackend_v20::sleepDisplay(bool sleep)
 {
-    m_displayOff = sleep;
+    waitForDisplay();
+    setDisplayPower(!sleep);
+}
+
+void
+HwComposerBackend_v20::setDisplayPower(bool on)
+{
+    const bool sleep = !on;
+    m_displayOff.store(sleep ? 1 : 0);
     if (sleep) {
-        // Stop the timer so we don't end up calling into eventControl after the
+        // Don't turn the display off under frames still being presented
+        if (m_presentThread)
+            m_presentThread->waitForCommitted(0);
+
+        // Suspend vsync so we don't end up calling into eventControl after the
         // screen has been turned off. Doing so leads to logcat errors being
         // logged.
-        m_vsyncTimeout.stop();
-        hwc2_compat_display_set_vsync_enabled(hwc2_primary_display, HWC2_VSYNC_DISABLE);
+        m_vsyncSource->suspend();
+
+        m_composition->setEnabled(false);
 
         hwc2_compat_display_set_power_mode(hwc2_primary_display, HWC2_POWER_MODE_OFF);
     } else {
         hwc2_compat_display_set_power_mode(hwc2_primary_display, HWC2_POWER_MODE_ON);
+        m_composition->setEnabled(true);
+
+        m_vsyncSource->resume();
 
         // If we have pending updates, make sure those start happening now..
-        if (m_pendingUpdate.size()) {
-            hwc2_compat_display_set_vsync_enabled(hwc2_primary_display, HWC2_VSYNC_ENABLE);
-            m_vsyncTimeout.start(50, this);
-        }
+        if (m_scheduler.hasPendingUpdates())
+            m_scheduler.requestVSync();
     }
 }
 
 float
 HwComposerBackend_v20::refreshRate()
+{
+    waitForDisplay();
+    return activeRefreshRate();
+}
+
+float
+HwComposerBackend_v20::activeRefreshRate()
 {
     float value = (float)hwc2_compat_display_get_active_config(hwc2_primary_display)->vsyncPeriod;
 
@@ -350,6 +947,8 @@ HwComposerBackend_v20::refreshRate()
 bool
 HwComposerBackend_v20::getScreenSizes(int *width, int *height, float *physical_width, float *physical_height)
 {
+    waitForDisplay();
+
     HWC2DisplayConfig *config = hwc2_compat_display_get_active_config(hwc2_primary_display);
 
     // should not happen
@@ -372,66 +971,29 @@ HwComposerBackend_v20::getScreenSizes(int *width, int *height, float *physical_w
     return true;
 }
 
-void HwComposerBackend_v20::timerEvent(QTimerEvent *e)
+void HwComposerBackend_v20::onVSyncReceived(int64_t timestamp)
 {
-    if (e->timerId() == m_vsyncTimeout.timerId()) {
-        hwc2_compat_display_set_vsync_enabled(hwc2_primary_display, HWC2_VSYNC_DISABLE);
-        m_vsyncTimeout.stop();
-        // When waking up, we might get here as a result of requesting vsync events
-        // before the hwc is up and running. If we're timing out while still waiting
-        // for vsync to occur, trigger the update so we don't block the UI.
-        if (!m_pendingUpdate.isEmpty())
-            handleVSyncEvent();
-    } else if (e->timerId() == m_deliverUpdateTimeout.timerId()) {
-        m_deliverUpdateTimeout.stop();
-        handleVSyncEvent();
-    }
+    m_scheduler.postVSync(timestamp);
 }
 
-bool HwComposerBackend_v20::event(QEvent *e)
+bool HwComposerBackend_v20::requestUpdate(QEglFSWindow *window)
 {
-    if (e->type() == QEvent::User) {
-        static int idleTime = qBound(5, qgetenv("QPA_HWC_IDLE_TIME").toInt(), 100);
-        if (!m_deliverUpdateTimeout.isActive())
-            m_deliverUpdateTimeout.start(idleTime, this);
-        return true;
-    }
-    return QObject::event(e);
+    // If the display is off, do updates via the normal Qt-based timer.
+    if (m_displayOff.load())
+        return false;
+
+    m_scheduler.scheduleUpdate(window->window());
+    return true;
 }
 
-void HwComposerBackend_v20::handleVSyncEvent()
+void HwComposerBackend_v20::frameSwapped(QEglFSWindow *window)
 {
-    QSystraceEvent trace("graphics", "QPA::handleVsync");
-    QSet<QWindow *> pendingWindows = m_pendingUpdate;
-    m_pendingUpdate.clear();
-    foreach (QWindow *w, pendingWindows) {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 12, 0))
-        QPlatformWindow *platformWindow = w->handle();
-        if (!platformWindow)
-            continue;
-
-        platformWindow->deliverUpdateRequest();
-#else
-        QWindowPrivate *wp = (QWindowPrivate *) QWindowPrivate::get(w);
-        wp->deliverUpdateRequest();
-#endif
-    }
+    m_scheduler.frameSwapped(window->window());
 }
 
-bool HwComposerBackend_v20::requestUpdate(QEglFSWindow *window)
+void HwComposerBackend_v20::forgetWindow(QEglFSWindow *window)
 {
-    // If the display is off, do updates via the normal Qt-based timer.
-    if (m_displayOff)
-        return false;
-
-    if (m_vsyncTimeout.isActive()) {
-        m_vsyncTimeout.stop();
-    } else {
-        hwc2_compat_display_set_vsync_enabled(hwc2_primary_display, HWC2_VSYNC_ENABLE);
-    }
-    m_vsyncTimeout.start(50, this);
-    m_pendingUpdate.insert(window->window());
-    return true;
+    m_scheduler.forgetWindow(window->window());
 }
 
 void HwComposerBackend_v20::onHotplugReceived(int32_t sequenceId,
@@ -439,6 +1001,20 @@ void HwComposerBackend_v20::onHotplugReceived(int32_t sequenceId,
                                         bool primaryDisplay)
 {
     hwc2_compat_device_on_hotplug(hwc2_device, display, connected);
+
+    {
+        QMutexLocker lock(&m_hotplugMutex);
+        m_hotplugCondition.wakeAll();
+    }
+
+    invalidateComposition();
+}
+
+void HwComposerBackend_v20::invalidateComposition()
+{
+    // Hotplug events arrive before the composition exists
+    if (m_displayReady.loadAcquire())
+        m_composition->invalidate();
 }
 
 // #endif /* HWC_PLUGIN_HAVE_HWCOMPOSER1_API */
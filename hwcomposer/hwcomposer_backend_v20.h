@@ -50,10 +50,17 @@
 
 #include <hybris/hwc2/hwc2_compatibility_layer.h>
 
-#include <QBasicTimer>
+#include "hwcomposer_frame_scheduler.h"
+#include "hwcomposer_present_thread.h"
+#include "hwcomposer_vsync_source.h"
+
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QAtomicInt>
 
 class HwcProcs_v20;
-class QWindow;
+class HwcComposition_v20;
+class HWC2Window;
 
 class HwComposerBackend_v20 : public QObject, public HwComposerBackend {
 public:
@@ -61,34 +68,69 @@ public:
     virtual ~HwComposerBackend_v20();
 
     virtual EGLNativeDisplayType display();
-    virtual EGLNativeWindowType createWindow(int width, int height);
+    virtual EGLNativeWindowType createWindow(int width, int height, int format);
     virtual void destroyWindow(EGLNativeWindowType window);
     virtual void swap(EGLNativeDisplayType display, EGLSurface surface);
+    virtual void swapWithDamage(EGLNativeDisplayType display, EGLSurface surface,
+                                EGLNativeWindowType window, const QRegion &damage) Q_DECL_OVERRIDE;
+    virtual void setFrameDamage(EGLNativeWindowType window, const QRegion &damage) Q_DECL_OVERRIDE;
     virtual void sleepDisplay(bool sleep);
     virtual float refreshRate();
     virtual bool getScreenSizes(int *width, int *height, float *physical_width, float *physical_height);
 
     virtual bool requestUpdate(QEglFSWindow *window) Q_DECL_OVERRIDE;
+    virtual void frameSwapped(QEglFSWindow *window) Q_DECL_OVERRIDE;
+    virtual void forgetWindow(QEglFSWindow *window) Q_DECL_OVERRIDE;
+
+    virtual bool supportsRasterBuffers() Q_DECL_OVERRIDE;
+
+    virtual bool supportsLayers() Q_DECL_OVERRIDE;
+    virtual EGLNativeWindowType createLayerWindow(int display, int width, int height, int format) Q_DECL_OVERRIDE;
+    virtual void setLayerState(EGLNativeWindowType window, const HwComposerLayerState &state) Q_DECL_OVERRIDE;
+
+    virtual bool scanoutBuffer(ANativeWindowBuffer *buffer, int *displayedFenceFd) Q_DECL_OVERRIDE;
+    virtual int endScanout() Q_DECL_OVERRIDE;
 
-    void timerEvent(QTimerEvent *) Q_DECL_OVERRIDE;
-    void handleVSyncEvent();
-    bool event(QEvent *e) Q_DECL_OVERRIDE;
+    void onVSyncReceived(int64_t timestamp);
 
     void onHotplugReceived(int32_t sequenceId, hwc2_display_t display,
                            bool connected, bool primaryDisplay);
 
+    // Makes the next frame validate the display state again
+    void invalidateComposition();
+
     static int composerSequenceId;
 
 private:
+    // Blocks until the primary display is connected and what depends on
+    // it is set up, whichever thread calls it first
+    void waitForDisplay();
+    // The parts of waitForDisplay() and the public API that do not wait,
+    // for while the display is being set up
+    void initDisplay();
+    void setDisplayPower(bool on);
+    float activeRefreshRate();
+
     hwc2_compat_device_t* hwc2_device;
     hwc2_compat_display_t* hwc2_primary_display;
     hwc2_compat_layer_t* hwc2_primary_layer;
 
-    bool m_displayOff;
-    QBasicTimer m_deliverUpdateTimeout;
-    QBasicTimer m_vsyncTimeout;
-    QSet<QWindow *> m_pendingUpdate;
+    // Written by whichever thread sets up or powers the display, read on
+    // the GUI thread
+    QAtomicInt m_displayOff;
+    HwComposerVSyncSource *m_vsyncSource;
+    HwComposerFrameScheduler m_scheduler;
+    HwComposerPresentThread *m_presentThread;
+    HwcComposition_v20 *m_composition;
+    HWC2Window *m_primaryWindow;
     HwcProcs_v20 *procs;
+
+    QMutex m_hotplugMutex;
+    QWaitCondition m_hotplugCondition;
+    // Lets one thread set up the display while others wait for it, HAL
+    // calls are never made under m_hotplugMutex
+    QMutex m_initMutex;
+    QAtomicInt m_displayReady;
 };
 
 #endif /* HWC_PLUGIN_HAVE_HWCOMPOSER1_API */
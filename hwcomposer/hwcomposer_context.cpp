@@ -47,11 +47,15 @@
 #include "hwcomposer_context.h"
 
 #include "qeglfscontext.h"
+#include "qeglfswindow.h"
 #include "hwcomposer_screeninfo.h"
 #include "hwcomposer_backend.h"
+#include "hwcomposer_stats.h"
 
 #include <qcoreapplication.h>
 
+#include <system/window.h>
+
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
@@ -70,12 +74,15 @@ static void exit_qt_gracefully(int sig)
     QCoreApplication::exit(0);
 }
 
-HwComposerContext::HwComposerContext()
-    : info(NULL)
-    , backend(NULL)
-    , display_off(false)
-    , window_created(false)
+HwComposerContext::HwComposerContext(HwComposerBackend *backend, HwComposerScreenInfo *info)
+    : info(info)
+    , backend(backend)
+    , sleeping_displays(0)
+    , scanout_active(false)
+    , raster_buffers(false)
+    , force_rgba(false)
     , fps(0)
+    , stats(NULL)
 {
     // We need to catch the SIGTERM and SIGINT signals, so that we can do a
     // proper shutdown of Qt and the plugin, and avoid crashes, hangs and
@@ -87,17 +94,32 @@ HwComposerContext::HwComposerContext()
     sigaction(SIGTERM, &new_action, NULL);
     sigaction(SIGINT, &new_action, NULL);
 
-    // This actually opens the hwcomposer device
-    backend = HwComposerBackend::create();
-    HWC_PLUGIN_ASSERT_NOT_NULL(backend);
+    // The refresh rate is looked up on first use, and so is the screen
+    // info if it was not probed already
+
+    // Some framebuffer targets only take RGBA_8888
+    force_rgba = qgetenv("QPA_HWC_WORKAROUNDS").split(',').contains("force-rgba");
 
-    fps = backend->refreshRate();
+    // Every Qt process loads the plugin, only export on request
+    if (qgetenv("QPA_HWC_STATS") == "1")
+        stats = new HwComposerStatsAdaptor;
 
-    info = new HwComposerScreenInfo(backend);
+#ifdef HWC_PLUGIN_HAVE_HWCOMPOSER1_API
+    raster_buffers = qgetenv("QPA_HWC_GRALLOC_BACKINGSTORE") == "1";
+    if (raster_buffers && !backend->supportsRasterBuffers()) {
+        qWarning("QPA-HWC: this hwcomposer can not show gralloc buffers of raster windows, "
+                 "ignoring QPA_HWC_GRALLOC_BACKINGSTORE");
+        raster_buffers = false;
+    }
+    if (raster_buffers)
+        qDebug("QPA-HWC: raster windows are drawn into gralloc buffers");
+#endif
 }
 
 HwComposerContext::~HwComposerContext()
 {
+    delete stats;
+
     // Properly clean up hwcomposer backend
     HwComposerBackend::destroy(backend);
 
@@ -112,29 +134,77 @@ EGLNativeDisplayType HwComposerContext::platformDisplay() const
 
 QSizeF HwComposerContext::physicalScreenSize() const
 {
-    return info->physicalScreenSize();
+    return screenInfo()->physicalScreenSize();
 }
 
 int HwComposerContext::screenDepth() const
 {
-    return info->screenDepth();
+    return screenInfo()->screenDepth();
 }
 
 QSize HwComposerContext::screenSize() const
 {
-    return info->screenSize();
+    return screenInfo()->screenSize();
+}
+
+void HwComposerContext::setDisplayListener(HwComposerDisplayListener *listener)
+{
+    backend->setDisplayListener(listener);
+}
+
+QSizeF HwComposerContext::physicalDisplaySize(int display) const
+{
+    if (display == 0)
+        return physicalScreenSize();
+
+    int width = 0, height = 0;
+    float physicalWidth = 0, physicalHeight = 0;
+    if (!backend->getDisplaySizes(display, &width, &height, &physicalWidth, &physicalHeight)) {
+        // Monitors often leave out their DPI, assume 100 like the screen info
+        physicalWidth = width * 25.4 / 100;
+        physicalHeight = height * 25.4 / 100;
+    }
+    return QSizeF(physicalWidth, physicalHeight);
+}
+
+QSize HwComposerContext::displaySize(int display) const
+{
+    if (display == 0)
+        return screenSize();
+
+    // The size is known even where the DPI is not
+    int width = 0, height = 0;
+    float physicalWidth, physicalHeight;
+    backend->getDisplaySizes(display, &width, &height, &physicalWidth, &physicalHeight);
+    return QSize(width, height);
+}
+
+qreal HwComposerContext::displayRefreshRate(int display) const
+{
+    if (display == 0)
+        return refreshRate();
+    return backend->displayRefreshRate(display);
+}
+
+HwComposerScreenInfo *HwComposerContext::screenInfo() const
+{
+    if (!info)
+        info = new HwComposerScreenInfo(backend);
+    return info;
 }
 
 QSurfaceFormat HwComposerContext::surfaceFormatFor(const QSurfaceFormat &inputFormat) const
 {
     QSurfaceFormat newFormat = inputFormat; 
-    if (screenDepth() == 16) {
+    if (screenDepth() == 16 && !inputFormat.hasAlpha() && !force_rgba) {
+        newFormat.setAlphaBufferSize(0);
         newFormat.setRedBufferSize(5);
         newFormat.setGreenBufferSize(6);
         newFormat.setBlueBufferSize(5);
     } else {
+        // Opaque windows do not need to carry alpha through the display
         newFormat.setStencilBufferSize(8);
-        newFormat.setAlphaBufferSize(8);
+        newFormat.setAlphaBufferSize(inputFormat.hasAlpha() || force_rgba ? 8 : 0);
         newFormat.setRedBufferSize(8);
         newFormat.setGreenBufferSize(8);
         newFormat.setBlueBufferSize(8);
@@ -143,51 +213,223 @@ QSurfaceFormat HwComposerContext::surfaceFormatFor(const QSurfaceFormat &inputFo
     return newFormat;
 }
 
-EGLNativeWindowType HwComposerContext::createNativeWindow(const QSurfaceFormat &format)
+int HwComposerContext::halFormatFor(const QSurfaceFormat &format)
 {
-    Q_UNUSED(format);
+    if (format.hasAlpha())
+        return HAL_PIXEL_FORMAT_RGBA_8888;
+    if (format.redBufferSize() == 5)
+        return HAL_PIXEL_FORMAT_RGB_565;
+    return HAL_PIXEL_FORMAT_RGBX_8888;
+}
+
+QImage::Format HwComposerContext::imageFormatFor(const QSurfaceFormat &format)
+{
+    // Byte order of the HAL formats, layers are blended premultiplied
+    switch (halFormatFor(format)) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+        return QImage::Format_RGBA8888_Premultiplied;
+    case HAL_PIXEL_FORMAT_RGB_565:
+        return QImage::Format_RGB16;
+    default:
+        return QImage::Format_RGBX8888;
+    }
+}
 
-    if (window_created) {
+void HwComposerContext::reserveNativeWindow(int display)
+{
+    if (fullscreen_reserved.contains(display)) {
         HWC_PLUGIN_FATAL("There can only be one window, someone tried to create more.");
     }
 
-    window_created = true;
-    QSize size = screenSize();
-    return backend->createWindow(size.width(), size.height());
+    fullscreen_reserved.insert(display);
 }
 
-void HwComposerContext::destroyNativeWindow(EGLNativeWindowType window)
+EGLNativeWindowType HwComposerContext::createNativeWindow(int display, const QSurfaceFormat &format)
 {
+    QSize size = displaySize(display);
+    if (display == 0)
+        return backend->createWindow(size.width(), size.height(), halFormatFor(format));
+    return backend->createDisplayWindow(display, size.width(), size.height(), halFormatFor(format));
+}
+
+void HwComposerContext::releaseNativeWindow(int display)
+{
+    // The primary window lives as long as the backend, the ones of other
+    // displays go away with their screen and come back with the next one
+    if (display != 0)
+        fullscreen_reserved.remove(display);
+}
+
+void HwComposerContext::destroyNativeWindow(int display, EGLNativeWindowType window)
+{
+    Q_UNUSED(display);
     return backend->destroyWindow(window);
 }
 
+bool HwComposerContext::canCreateLayer(int display) const
+{
+    return fullscreen_reserved.contains(display) && backend->supportsLayers();
+}
+
+static HwComposerLayerState layerStateFor(QEglFSWindow *window, int z)
+{
+    HwComposerLayerState state;
+    state.geometry = window->geometry();
+    state.opacity = window->opacity();
+    state.visible = window->isLayerVisible();
+    // The fullscreen window and direct scanout are below
+    state.z = z + 2;
+    return state;
+}
+
+EGLNativeWindowType HwComposerContext::createLayerWindow(QEglFSWindow *window)
+{
+    const QSize size = window->geometry().size();
+    EGLNativeWindowType native = backend->createLayerWindow(window->hwcDisplay(),
+                                                            size.width(), size.height(),
+                                                            halFormatFor(window->format()));
+
+    // New windows go on top
+    QMutexLocker lock(&layers_mutex);
+    layers.removeOne(window);
+    layers.append(window);
+    backend->setLayerState(native, layerStateFor(window, layers.size() - 1));
+
+    return native;
+}
+
+void HwComposerContext::destroyLayerWindow(QEglFSWindow *window, EGLNativeWindowType native)
+{
+    QMutexLocker lock(&layers_mutex);
+    layers.removeOne(window);
+    backend->destroyWindow(native);
+    restackLayers();
+}
+
+void HwComposerContext::updateLayer(QEglFSWindow *window)
+{
+    QMutexLocker lock(&layers_mutex);
+    const int z = layers.indexOf(window);
+    if (z >= 0)
+        setLayerState(window, z);
+}
+
+void HwComposerContext::setLayerState(QEglFSWindow *window, int z)
+{
+    if (window->winId())
+        backend->setLayerState((EGLNativeWindowType) window->winId(), layerStateFor(window, z));
+}
+
+void HwComposerContext::resizeLayerWindow(QEglFSWindow *window)
+{
+    ANativeWindow *native = (ANativeWindow *) window->nativeWindow();
+    if (!native)
+        return;
+
+    const QSize size = window->geometry().size();
+    native_window_set_buffers_dimensions(native, size.width(), size.height());
+    updateLayer(window);
+}
+
+void HwComposerContext::raiseLayer(QEglFSWindow *window)
+{
+    QMutexLocker lock(&layers_mutex);
+    if (!layers.removeOne(window))
+        return;
+
+    layers.append(window);
+    restackLayers();
+}
+
+void HwComposerContext::lowerLayer(QEglFSWindow *window)
+{
+    QMutexLocker lock(&layers_mutex);
+    if (!layers.removeOne(window))
+        return;
+
+    layers.prepend(window);
+    restackLayers();
+}
+
+void HwComposerContext::restackLayers()
+{
+    // Called with layers_mutex held
+    for (int z = 0; z < layers.size(); ++z)
+        setLayerState(layers.at(z), z);
+}
+
 void HwComposerContext::swapToWindow(QEglFSContext *context, QPlatformSurface *surface)
 {
-    if (display_off) {
+    QEglFSWindow *window = static_cast<QEglFSWindow *>(surface);
+    if (isSleeping(window->hwcDisplay())) {
         qWarning("Swap requested while display is off");
         return;
     }
 
     EGLDisplay egl_display = context->eglDisplay();
     EGLSurface egl_surface = context->eglSurfaceForPlatformSurface(surface);
-    return backend->swap(egl_display, egl_surface);
+
+    const QRegion damage = window->takeSwapDamage();
+
+    // The fullscreen window is covered by the scanout buffer, a frame from
+    // it would only replace that buffer on screen
+    if (!isCoveredByScanout(window)) {
+        HwComposerStats::Timer timer;
+        backend->swapWithDamage(egl_display, egl_surface, window->nativeWindow(), damage);
+        timer.lap(HwComposerStats::Swap);
+    }
+
+    backend->frameSwapped(window);
+}
+
+bool HwComposerContext::rasterBuffersEnabled() const
+{
+    return raster_buffers;
 }
 
-void HwComposerContext::sleepDisplay(bool sleep)
+void HwComposerContext::presentRasterBuffer(QEglFSWindow *window, ANativeWindowBuffer *buffer, const QRegion &damage)
+{
+    ANativeWindow *native = (ANativeWindow *) window->nativeWindow();
+
+    // Like a skipped swap, the buffer goes back to the window unseen
+    if (isSleeping(window->hwcDisplay()) || isCoveredByScanout(window)) {
+        native->cancelBuffer(native, buffer, -1);
+        return;
+    }
+
+    HwComposerStats::Timer timer;
+    backend->setFrameDamage(window->nativeWindow(), damage);
+    native->queueBuffer(native, buffer, -1);
+    timer.lap(HwComposerStats::Swap);
+
+    backend->frameSwapped(window);
+}
+
+void HwComposerContext::sleepDisplay(int display, bool sleep)
 {
     if (sleep) {
-        qDebug("sleepDisplay");
-        display_off = true;
+        qDebug("sleepDisplay %d", display);
+        sleeping_displays.fetchAndOrOrdered(1 << display);
     } else {
-        qDebug("unsleepDisplay");
-        display_off = false;
+        qDebug("unsleepDisplay %d", display);
+        sleeping_displays.fetchAndAndOrdered(~(1 << display));
     }
 
-    backend->sleepDisplay(sleep);
+    if (display == 0)
+        backend->sleepDisplay(sleep);
+    else
+        backend->sleepExternalDisplay(display, sleep);
+}
+
+bool HwComposerContext::isSleeping(int display) const
+{
+    return sleeping_displays.load() & (1 << display);
 }
 
 qreal HwComposerContext::refreshRate() const
 {
+    if (!fps)
+        fps = backend->refreshRate();
     return fps;
 }
 
@@ -198,6 +440,38 @@ bool HwComposerContext::requestUpdate(QEglFSWindow *window)
     return false;
 }
 
+void HwComposerContext::forgetWindow(QEglFSWindow *window)
+{
+    if (backend)
+        backend->forgetWindow(window);
+}
+
+bool HwComposerContext::scanoutBuffer(void *nativeBuffer, int *displayedFenceFd)
+{
+    if (isSleeping(0))
+        return false;
+
+    if (!backend->scanoutBuffer(static_cast<ANativeWindowBuffer *>(nativeBuffer), displayedFenceFd))
+        return false;
+
+    scanout_active.store(1);
+    return true;
+}
+
+int HwComposerContext::endScanout()
+{
+    if (!scanout_active.testAndSetOrdered(1, 0))
+        return -1;
+
+    return backend->endScanout();
+}
+
+bool HwComposerContext::isCoveredByScanout(QEglFSWindow *window) const
+{
+    // Client buffers only replace the fullscreen window of the primary display
+    return scanout_active.load() && !window->isLayer() && window->hwcDisplay() == 0;
+}
+
 
 
 QT_END_NAMESPACE
@@ -48,11 +48,16 @@
 #define HWCOMPOSER_CONTEXT_H
 
 #include <QtGlobal>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
 
 #include <qpa/qplatformintegration.h>
 #include <qpa/qplatformscreen.h>
 #include <QtGui/QSurfaceFormat>
 #include <QtGui/QImage>
+#include <QtGui/QRegion>
 #include <EGL/egl.h>
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 8, 0))
@@ -67,36 +72,107 @@ class QEglFSContext;
 class QEglFSWindow;
 class HwComposerScreenInfo;
 class HwComposerBackend;
+class HwComposerStatsAdaptor;
+struct ANativeWindowBuffer;
+
+// Told about displays besides the primary one coming and going, on the GUI
+// thread. Displays are numbered like HWC_DISPLAY_*, the primary one is 0.
+class HwComposerDisplayListener
+{
+public:
+    virtual ~HwComposerDisplayListener() {}
+
+    virtual void displayConnected(int display) = 0;
+    virtual void displayDisconnected(int display) = 0;
+};
 
 class HwComposerContext
 {
 public:
-    HwComposerContext();
+    // Takes ownership of backend and info, see HwComposerStartup
+    HwComposerContext(HwComposerBackend *backend, HwComposerScreenInfo *info);
     ~HwComposerContext();
 
     QSizeF physicalScreenSize() const;
     QSize screenSize() const;
     int screenDepth() const;
 
+    // Like the above for any display, 0 is the primary one
+    void setDisplayListener(HwComposerDisplayListener *listener);
+    QSizeF physicalDisplaySize(int display) const;
+    QSize displaySize(int display) const;
+    qreal displayRefreshRate(int display) const;
+
     QSurfaceFormat surfaceFormatFor(const QSurfaceFormat &inputFormat) const;
 
+    // Pixel format of the buffers, EGL config and raster content of a
+    // window with a format from surfaceFormatFor(), so that they all agree
+    static int halFormatFor(const QSurfaceFormat &format);
+    static QImage::Format imageFormatFor(const QSurfaceFormat &format);
+
     EGLNativeDisplayType platformDisplay() const;
-    EGLNativeWindowType createNativeWindow(const QSurfaceFormat &format);
-    void destroyNativeWindow(EGLNativeWindowType window);
+    // The fullscreen window of a display is taken as soon as a platform
+    // window is going to be it, its buffers are only allocated with
+    // createNativeWindow() once it is shown or drawn to
+    void reserveNativeWindow(int display);
+    // Ends the reservation, whether or not the window was ever allocated
+    void releaseNativeWindow(int display);
+    EGLNativeWindowType createNativeWindow(int display, const QSurfaceFormat &format);
+    void destroyNativeWindow(int display, EGLNativeWindowType window);
+
+    // Windows created after the fullscreen one can be hardware layers
+    bool canCreateLayer(int display) const;
+    EGLNativeWindowType createLayerWindow(QEglFSWindow *window);
+    void destroyLayerWindow(QEglFSWindow *window, EGLNativeWindowType native);
+    void updateLayer(QEglFSWindow *window);
+    // New buffers of the size of the window are allocated on the next
+    // dequeue, the window keeps its place in the stack
+    void resizeLayerWindow(QEglFSWindow *window);
+    void raiseLayer(QEglFSWindow *window);
+    void lowerLayer(QEglFSWindow *window);
 
     void swapToWindow(QEglFSContext *context, QPlatformSurface *surface);
 
-    void sleepDisplay(bool sleep);
+    // Raster windows can fill gralloc buffers of their native window with
+    // the CPU and have them shown without going through GL
+    bool rasterBuffersEnabled() const;
+    void presentRasterBuffer(QEglFSWindow *window, ANativeWindowBuffer *buffer, const QRegion &damage);
+
+    void sleepDisplay(int display, bool sleep);
     qreal refreshRate() const;
 
     bool requestUpdate(QEglFSWindow *window);
+    void forgetWindow(QEglFSWindow *window);
+
+    // Client buffer shown instead of the fullscreen window, see
+    // HwComposerBackend::scanoutBuffer()
+    bool scanoutBuffer(void *nativeBuffer, int *displayedFenceFd);
+    int endScanout();
 
 private:
-    HwComposerScreenInfo *info;
+    void restackLayers();
+    void setLayerState(QEglFSWindow *window, int z);
+    bool isCoveredByScanout(QEglFSWindow *window) const;
+    bool isSleeping(int display) const;
+    HwComposerScreenInfo *screenInfo() const;
+
+    mutable HwComposerScreenInfo *info;
     HwComposerBackend *backend;
-    bool display_off;
-    bool window_created;
-    qreal fps;
+    // Bit 1 << display is set while the display sleeps. Changed on the GUI
+    // thread, read by the threads that swap and scan out.
+    QAtomicInt sleeping_displays;
+    QSet<int> fullscreen_reserved;
+    // Set and read from whichever threads the compositor scans out and
+    // swaps on
+    QAtomicInt scanout_active;
+    bool raster_buffers;
+    bool force_rgba;
+    mutable qreal fps;
+    HwComposerStatsAdaptor *stats;
+    // Bottom to top. Layer windows are created on whichever thread first
+    // draws to them, so the stack is changed under layers_mutex.
+    QList<QEglFSWindow *> layers;
+    QMutex layers_mutex;
 };
 
 QT_END_NAMESPACE
@@ -0,0 +1,279 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "hwcomposer_fence_policy.h"
+#include "hwcomposer_stats.h"
+
+#include <QtCore/QVariantMap>
+#include <QtDebug>
+
+#include <sync/sync.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Fence timestamps are in CLOCK_MONOTONIC
+static qint64 monotonicNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// When a signaled fence signaled, the latest of its sync points, or
+// fallback if the driver does not tell
+static qint64 fenceSignalTime(int fenceFd, qint64 fallback)
+{
+    struct sync_fence_info_data *info = sync_fence_info(fenceFd);
+    if (!info)
+        return fallback;
+
+    qint64 signaled = 0;
+    struct sync_pt_info *pt = NULL;
+    while ((pt = sync_pt_info(info, pt)))
+        signaled = qMax(signaled, qint64(pt->timestamp_ns));
+    sync_fence_info_free(info);
+
+    return signaled > 0 ? signaled : fallback;
+}
+
+HwComposerFencePolicy::HwComposerFencePolicy(int supportedFlags, float refreshRate)
+    : m_candidateCount(0)
+    , m_candidate(0)
+    , m_exploring(true)
+    , m_pinned(false)
+    , m_frames(0)
+    , m_round(0)
+    , m_current(HalFences)
+    , m_pendingCount(0)
+    , m_vsyncPeriod(1000000000 / 60)
+    , m_frameStart(0)
+    , m_lastFrameStart(0)
+{
+    if (refreshRate > 0)
+        m_vsyncPeriod = qint64(1000000000.0 / refreshRate);
+
+    int pinned = HalFences;
+    if (qEnvironmentVariableIsSet("QPA_HWC_SYNC_BEFORE_SET"))
+        pinned |= SyncBeforeSet;
+    if (qEnvironmentVariableIsSet("QPA_HWC_WAIT_ON_RETIRE_FENCE"))
+        pinned |= WaitOnRetireFence;
+    pinned &= supportedFlags;
+
+    if (pinned != HalFences) {
+        m_pinned = true;
+        m_exploring = false;
+        m_current.store(pinned);
+    }
+
+    for (int policy = 0; policy < MaxCandidates; ++policy) {
+        if ((policy & supportedFlags) == policy)
+            m_candidates[m_candidateCount++] = policy;
+    }
+
+    resetScores();
+    publish();
+}
+
+HwComposerFencePolicy::~HwComposerFencePolicy()
+{
+    for (int i = 0; i < m_pendingCount; ++i)
+        close(m_pending[i].fenceFd);
+}
+
+QByteArray HwComposerFencePolicy::policyName(int policy)
+{
+    switch (policy) {
+    case HalFences:
+        return "hal-fences";
+    case SyncBeforeSet:
+        return "sync-before-set";
+    case WaitOnRetireFence:
+        return "wait-on-retire-fence";
+    case SyncBeforeSet | WaitOnRetireFence:
+        return "sync-before-set+wait-on-retire-fence";
+    }
+    return "unknown";
+}
+
+int HwComposerFencePolicy::beginFrame()
+{
+    m_frameStart = monotonicNow();
+    return m_current.load();
+}
+
+void HwComposerFencePolicy::endFrame(bool displayFrame, int displayedFenceFd)
+{
+    if (m_pinned || !displayFrame)
+        return;
+
+    collectFences(false);
+
+    const qint64 interval = m_frameStart - m_lastFrameStart;
+    m_lastFrameStart = m_frameStart;
+
+    // Only frames rendered back to back say something about drops, a gap
+    // of several vsyncs means the UI was simply idle.
+    if (interval > 4 * m_vsyncPeriod)
+        return;
+
+    if (m_exploring) {
+        Score &score = m_scores[m_candidate];
+        if (2 * interval > 3 * m_vsyncPeriod)
+            ++score.drops;
+
+        const int fenceFd = displayedFenceFd != -1 ? dup(displayedFenceFd) : -1;
+        if (fenceFd == -1) {
+            // Nothing to wait for, the frame is out once committed
+            measured(m_candidate, m_round, monotonicNow() - m_frameStart);
+        } else {
+            if (m_pendingCount == MaxPendingFences) {
+                // Fences signal in order, the oldest one is stuck
+                close(m_pending[0].fenceFd);
+                memmove(m_pending, m_pending + 1, --m_pendingCount * sizeof(PendingFence));
+            }
+            PendingFence &pending = m_pending[m_pendingCount++];
+            pending.fenceFd = fenceFd;
+            pending.start = m_frameStart;
+            pending.candidate = m_candidate;
+            pending.round = m_round;
+        }
+
+        if (++score.frames >= ExploreFrames)
+            nextCandidate();
+    } else if (++m_frames >= ExploitFrames) {
+        // Conditions change (thermal state, GPU load), measure again
+        resetScores();
+        m_exploring = true;
+        m_candidate = 0;
+        m_current.store(m_candidates[0]);
+        publish();
+    }
+}
+
+void HwComposerFencePolicy::collectFences(bool wait)
+{
+    const qint64 now = monotonicNow();
+
+    int kept = 0;
+    for (int i = 0; i < m_pendingCount; ++i) {
+        PendingFence &pending = m_pending[i];
+        if (sync_wait(pending.fenceFd, wait ? 1000 : 0) == 0) {
+            measured(pending.candidate, pending.round,
+                     fenceSignalTime(pending.fenceFd, now) - pending.start);
+            close(pending.fenceFd);
+        } else if (wait) {
+            close(pending.fenceFd);
+        } else {
+            m_pending[kept++] = pending;
+        }
+    }
+    m_pendingCount = kept;
+}
+
+void HwComposerFencePolicy::measured(int candidate, int round, qint64 latency)
+{
+    if (round != m_round || latency < 0)
+        return;
+
+    m_scores[candidate].latency += latency;
+    ++m_scores[candidate].measured;
+}
+
+void HwComposerFencePolicy::nextCandidate()
+{
+    if (++m_candidate < m_candidateCount) {
+        m_current.store(m_candidates[m_candidate]);
+    } else {
+        // The last frames of the last candidate count too
+        collectFences(true);
+        choose();
+    }
+}
+
+qint64 HwComposerFencePolicy::cost(const Score &score) const
+{
+    if (!score.frames || !score.measured)
+        return 0;
+
+    // A dropped frame costs a whole vsync period
+    return score.latency / score.measured + qint64(score.drops) * m_vsyncPeriod / score.frames;
+}
+
+void HwComposerFencePolicy::choose()
+{
+    int best = 0;
+    for (int i = 1; i < m_candidateCount; ++i) {
+        if (cost(m_scores[i]) < cost(m_scores[best]))
+            best = i;
+    }
+
+    const int previous = m_current.load();
+    m_current.store(m_candidates[best]);
+    m_exploring = false;
+    m_frames = 0;
+    publish();
+
+    if (m_candidates[best] != previous)
+        qDebug("QPA-HWC: using fence policy %s", policyName(m_candidates[best]).constData());
+}
+
+void HwComposerFencePolicy::resetScores()
+{
+    for (int i = 0; i < m_candidateCount; ++i) {
+        m_scores[i].latency = 0;
+        m_scores[i].measured = 0;
+        m_scores[i].frames = 0;
+        m_scores[i].drops = 0;
+    }
+    ++m_round;
+}
+
+void HwComposerFencePolicy::publish() const
+{
+    QVariantMap summary;
+    summary.insert(QStringLiteral("policy"), QString::fromLatin1(policyName(m_current.load())));
+    summary.insert(QStringLiteral("pinned"), m_pinned);
+    summary.insert(QStringLiteral("exploring"), m_exploring);
+    for (int i = 0; i < m_candidateCount && !m_pinned; ++i) {
+        const QString name = QString::fromLatin1(policyName(m_candidates[i]));
+        summary.insert(name + QStringLiteral("_us"), cost(m_scores[i]) / 1000);
+        summary.insert(name + QStringLiteral("_drops"), m_scores[i].drops);
+    }
+    HwComposerStats::instance()->setFencePolicy(summary);
+}
@@ -0,0 +1,135 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef HWCOMPOSER_FENCE_POLICY_H
+#define HWCOMPOSER_FENCE_POLICY_H
+
+#include <QtGlobal>
+#include <QAtomicInt>
+
+// Decides at runtime how a native window deals with buffer fences: whether
+// the CPU waits for the acquire fence before handing the buffer to the
+// hwcomposer, and whether it waits for the previous frame's retire fence.
+//
+// Which of these is fastest depends on the device, so each candidate policy
+// is tried for a while and scored by how long frames of the primary display
+// take from the start of their commit until their present (or retire) fence
+// signals, plus the frames dropped while using it. Waits the HAL does on
+// fences handed to it count as much as the ones done here. The cheapest
+// policy is used until the next re-evaluation, and is reported through
+// HwComposerStats. Setting QPA_HWC_SYNC_BEFORE_SET or
+// QPA_HWC_WAIT_ON_RETIRE_FENCE pins the policy as before.
+class HwComposerFencePolicy
+{
+public:
+    enum Flag {
+        HalFences = 0x0,
+        SyncBeforeSet = 0x1,
+        WaitOnRetireFence = 0x2
+    };
+
+    // supportedFlags are the flags the caller knows how to honor
+    HwComposerFencePolicy(int supportedFlags, float refreshRate);
+    ~HwComposerFencePolicy();
+
+    // Returns the policy flags to use for this commit
+    int beginFrame();
+    // Ends the commit. Only display frames, the ones showing a new frame
+    // of the fullscreen window of the primary display, are scored. The
+    // policy keeps its own duplicate of displayedFenceFd, which may be -1.
+    void endFrame(bool displayFrame, int displayedFenceFd);
+
+    int currentPolicy() const { return m_current.load(); }
+    bool isPinned() const { return m_pinned; }
+
+    static QByteArray policyName(int policy);
+
+private:
+    enum {
+        MaxCandidates = 4,
+        // Frames each candidate is measured for while exploring
+        ExploreFrames = 120,
+        // Frames before exploring again, a minute at 60 Hz
+        ExploitFrames = 3600,
+        // Display frames whose fence has not signaled yet
+        MaxPendingFences = 4
+    };
+
+    struct Score {
+        // Sum and count of the frames whose fence was seen signaling
+        qint64 latency;
+        int measured;
+        int frames;
+        int drops;
+    };
+
+    struct PendingFence {
+        int fenceFd;
+        qint64 start;
+        int candidate;
+        int round;
+    };
+
+    void collectFences(bool wait);
+    void measured(int candidate, int round, qint64 latency);
+    void nextCandidate();
+    qint64 cost(const Score &score) const;
+    void choose();
+    void resetScores();
+    void publish() const;
+
+    int m_candidates[MaxCandidates];
+    Score m_scores[MaxCandidates];
+    int m_candidateCount;
+    int m_candidate;
+    bool m_exploring;
+    bool m_pinned;
+    int m_frames;
+    // Bumped when exploring starts over, older fences score nothing
+    int m_round;
+    QAtomicInt m_current;
+
+    PendingFence m_pending[MaxPendingFences];
+    int m_pendingCount;
+
+    qint64 m_vsyncPeriod;
+    qint64 m_frameStart;
+    qint64 m_lastFrameStart;
+};
+
+#endif /* HWCOMPOSER_FENCE_POLICY_H */
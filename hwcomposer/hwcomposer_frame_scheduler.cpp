@@ -0,0 +1,310 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "hwcomposer_frame_scheduler.h"
+#include "hwcomposer_vsync_source.h"
+
+#include <QtCore/QPointer>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QTimerEvent>
+#include <QtGui/QWindow>
+#include <qpa/qplatformwindow.h>
+#include <private/qwindow_p.h>
+
+#include "qsystrace_selector.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Time reserved between the predicted end of rendering and the vsync, to
+// cover the swap itself and the scheduling jitter of the GUI thread.
+static const qint64 FRAME_MARGIN = 1000000;
+
+// If no vsync arrives this long after an update was requested, deliver the
+// update anyway so we don't block the UI. This happens when waking up, as a
+// result of requesting vsync events before the hwc is up and running.
+static const int VSYNC_WATCHDOG_TIME = 50;
+
+class HwComposerVSyncNotifier : public QSocketNotifier
+{
+public:
+    HwComposerVSyncNotifier(int fd, HwComposerFrameScheduler *scheduler)
+        : QSocketNotifier(fd, QSocketNotifier::Read, scheduler)
+        , m_scheduler(scheduler)
+    {
+    }
+
+protected:
+    bool event(QEvent *e) Q_DECL_OVERRIDE
+    {
+        if (e->type() == QEvent::SockAct) {
+            m_scheduler->drainVSyncs();
+            return true;
+        }
+        return QSocketNotifier::event(e);
+    }
+
+private:
+    HwComposerFrameScheduler *m_scheduler;
+};
+
+HwComposerFrameScheduler::HwComposerFrameScheduler()
+    : m_vsyncPeriod(1000000000 / 60)
+    , m_fixedDelay(-1)
+    , m_vsyncSource(NULL)
+    , m_vsyncEventFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    , m_vsyncNotifier(NULL)
+    , m_vsyncHead(0)
+    , m_vsyncTail(0)
+{
+    // QPA_HWC_IDLE_TIME used to be the only way to tune the delivery, keep
+    // honoring it for devices that were tuned that way.
+    if (qEnvironmentVariableIsSet("QPA_HWC_IDLE_TIME"))
+        m_fixedDelay = qBound(5, qgetenv("QPA_HWC_IDLE_TIME").toInt(), 100);
+
+    if (m_vsyncEventFd == -1)
+        qFatal("QPA-HWC: eventfd() failed in %s", __func__);
+
+    m_vsyncNotifier = new HwComposerVSyncNotifier(m_vsyncEventFd, this);
+}
+
+HwComposerFrameScheduler::~HwComposerFrameScheduler()
+{
+    delete m_vsyncNotifier;
+    close(m_vsyncEventFd);
+}
+
+qint64 HwComposerFrameScheduler::monotonicTime()
+{
+    // The hwcomposer reports vsync timestamps in CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void HwComposerFrameScheduler::setRefreshRate(float refreshRate)
+{
+    if (refreshRate > 0)
+        m_vsyncPeriod = qint64(1000000000.0 / refreshRate);
+}
+
+void HwComposerFrameScheduler::scheduleUpdate(QWindow *window)
+{
+    if (!m_pendingUpdate.contains(window))
+        m_pendingUpdate.append(window);
+
+    requestVSync();
+}
+
+void HwComposerFrameScheduler::requestVSync()
+{
+    if (m_vsyncSource)
+        m_vsyncSource->request();
+
+    if (!m_vsyncWatchdog.isActive())
+        m_vsyncWatchdog.start(VSYNC_WATCHDOG_TIME, this);
+}
+
+void HwComposerFrameScheduler::postVSync(int64_t timestamp)
+{
+    const int head = m_vsyncHead.load();
+    const int next = (head + 1) % VSyncRingSize;
+
+    // If the ring is full the GUI thread is several vsyncs behind, the
+    // timestamps already queued are enough to get the phase right.
+    if (next != m_vsyncTail.loadAcquire()) {
+        m_vsyncRing[head] = timestamp;
+        m_vsyncHead.storeRelease(next);
+    }
+
+    const uint64_t wakeup = 1;
+    if (write(m_vsyncEventFd, &wakeup, sizeof(wakeup)) != sizeof(wakeup)) {
+        // The counter can only overflow if the GUI thread stopped reading
+        // it, in which case it will catch up once it drains the ring.
+    }
+}
+
+void HwComposerFrameScheduler::drainVSyncs()
+{
+    uint64_t wakeups;
+    if (read(m_vsyncEventFd, &wakeups, sizeof(wakeups)) != sizeof(wakeups))
+        return;
+
+    qint64 timestamp = 0;
+    int tail = m_vsyncTail.load();
+    while (tail != m_vsyncHead.loadAcquire()) {
+        timestamp = m_vsyncRing[tail];
+        tail = (tail + 1) % VSyncRingSize;
+        m_vsyncTail.storeRelease(tail);
+    }
+
+    // Only the most recent vsync matters for the phase
+    handleVSync(timestamp);
+}
+
+void HwComposerFrameScheduler::forgetWindow(QWindow *window)
+{
+    const int pending = m_pendingUpdate.indexOf(window);
+    if (pending >= 0)
+        m_pendingUpdate.remove(pending);
+
+    QMutexLocker lock(&m_renderTimeMutex);
+    m_renderTimes.remove(window);
+}
+
+void HwComposerFrameScheduler::frameSwapped(QWindow *window)
+{
+    const qint64 now = monotonicTime();
+
+    QMutexLocker lock(&m_renderTimeMutex);
+    QHash<QWindow *, RenderTime>::iterator it = m_renderTimes.find(window);
+    if (it == m_renderTimes.end() || !it->deliveredAt)
+        return;
+
+    const qint64 sample = now - it->deliveredAt;
+    it->deliveredAt = 0;
+
+    // Ignore outliers such as the first frame or frames blocked on the
+    // display being turned on, they say nothing about the steady state.
+    if (sample > 4 * m_vsyncPeriod)
+        return;
+
+    if (!it->average) {
+        it->average = sample;
+        it->deviation = sample / 2;
+    } else {
+        // Same smoothing as TCP's RTT estimator (RFC 6298)
+        const qint64 error = sample - it->average;
+        it->average += error / 8;
+        it->deviation += (qAbs(error) - it->deviation) / 4;
+    }
+}
+
+qint64 HwComposerFrameScheduler::predictedRenderTime()
+{
+    qint64 predicted = 0;
+
+    QMutexLocker lock(&m_renderTimeMutex);
+    for (int i = 0; i < m_pendingUpdate.size(); ++i) {
+        QHash<QWindow *, RenderTime>::const_iterator it = m_renderTimes.constFind(m_pendingUpdate.at(i));
+        if (it == m_renderTimes.constEnd() || !it->average) {
+            // Nothing measured yet, give the window the whole frame
+            return m_vsyncPeriod;
+        }
+        predicted = qMax(predicted, it->average + 2 * it->deviation);
+    }
+
+    return predicted + FRAME_MARGIN;
+}
+
+void HwComposerFrameScheduler::handleVSync(qint64 timestamp)
+{
+    const qint64 now = monotonicTime();
+
+    // Fall back to the arrival time if the HAL hands us a timestamp that
+    // does not look like it is from CLOCK_MONOTONIC.
+    if (timestamp <= 0 || timestamp > now || now - timestamp > 4 * m_vsyncPeriod)
+        timestamp = now;
+
+    if (m_pendingUpdate.isEmpty() || m_deliverUpdateTimeout.isActive())
+        return;
+
+    m_vsyncWatchdog.stop();
+
+    if (m_fixedDelay >= 0) {
+        m_deliverUpdateTimeout.start(m_fixedDelay, Qt::PreciseTimer, this);
+        return;
+    }
+
+    qint64 nextVSync = timestamp + m_vsyncPeriod;
+    while (nextVSync <= now)
+        nextVSync += m_vsyncPeriod;
+
+    const int delay = int((nextVSync - predictedRenderTime() - now) / 1000000);
+    if (delay > 0)
+        m_deliverUpdateTimeout.start(delay, Qt::PreciseTimer, this);
+    else
+        deliverUpdates();
+}
+
+void HwComposerFrameScheduler::deliverUpdates()
+{
+    QSystraceEvent trace("graphics", "QPA::handleVsync");
+
+    m_deliverUpdateTimeout.stop();
+    m_vsyncWatchdog.stop();
+
+    // Windows may request another update while handling this one, so
+    // deliver from a copy. Handling an update may also destroy a window
+    // further down the copy, which is then skipped.
+    QVarLengthArray<QPointer<QWindow>, 8> pendingWindows;
+    for (int i = 0; i < m_pendingUpdate.size(); ++i)
+        pendingWindows.append(m_pendingUpdate.at(i));
+    m_pendingUpdate.clear();
+
+    const qint64 now = monotonicTime();
+    for (int i = 0; i < pendingWindows.size(); ++i) {
+        QWindow *w = pendingWindows.at(i);
+        if (!w)
+            continue;
+
+        {
+            QMutexLocker lock(&m_renderTimeMutex);
+            m_renderTimes[w].deliveredAt = now;
+        }
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 12, 0))
+        QPlatformWindow *platformWindow = w->handle();
+        if (!platformWindow)
+            continue;
+
+        platformWindow->deliverUpdateRequest();
+#else
+        QWindowPrivate *wp = (QWindowPrivate *) QWindowPrivate::get(w);
+        wp->deliverUpdateRequest();
+#endif
+    }
+}
+
+void HwComposerFrameScheduler::timerEvent(QTimerEvent *e)
+{
+    if (e->timerId() == m_deliverUpdateTimeout.timerId()
+            || e->timerId() == m_vsyncWatchdog.timerId())
+        deliverUpdates();
+}
@@ -0,0 +1,122 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef HWCOMPOSER_FRAME_SCHEDULER_H
+#define HWCOMPOSER_FRAME_SCHEDULER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QBasicTimer>
+#include <QHash>
+#include <QMutex>
+#include <QVarLengthArray>
+
+#include <stdint.h>
+
+class QWindow;
+class HwComposerVSyncNotifier;
+class HwComposerVSyncSource;
+
+// Delivers update requests to windows so that rendering finishes just in
+// time for the next vsync. The HAL vsync timestamps give us the display
+// phase, and the time between delivering an update request and the window
+// swapping gives us a per-window estimate of the render cost.
+class HwComposerFrameScheduler : public QObject
+{
+public:
+    HwComposerFrameScheduler();
+    ~HwComposerFrameScheduler();
+
+    void setRefreshRate(float refreshRate);
+    void setVSyncSource(HwComposerVSyncSource *source) { m_vsyncSource = source; }
+
+    void scheduleUpdate(QWindow *window);
+    void requestVSync();
+    bool hasPendingUpdates() const { return !m_pendingUpdate.isEmpty(); }
+    void deliverUpdates();
+
+    // Called from the hwcomposer vsync callback thread. This must not
+    // allocate or take locks, the timestamp goes through a preallocated
+    // single-producer/single-consumer ring and the GUI thread is woken up
+    // through an eventfd watched by its event dispatcher.
+    void postVSync(int64_t timestamp);
+
+    // Called from the thread that swapped the window
+    void frameSwapped(QWindow *window);
+
+    // Drops the pending update and render time of a window that goes away
+    void forgetWindow(QWindow *window);
+
+    static qint64 monotonicTime();
+
+protected:
+    void timerEvent(QTimerEvent *e) Q_DECL_OVERRIDE;
+
+private:
+    friend class HwComposerVSyncNotifier;
+
+    enum { VSyncRingSize = 8 };
+    struct RenderTime {
+        RenderTime() : deliveredAt(0), average(0), deviation(0) {}
+        qint64 deliveredAt;
+        qint64 average;
+        qint64 deviation;
+    };
+
+    void drainVSyncs();
+    void handleVSync(qint64 timestamp);
+    qint64 predictedRenderTime();
+
+    qint64 m_vsyncPeriod;
+    int m_fixedDelay;
+    QBasicTimer m_deliverUpdateTimeout;
+    QBasicTimer m_vsyncWatchdog;
+    HwComposerVSyncSource *m_vsyncSource;
+    QVarLengthArray<QWindow *, 8> m_pendingUpdate;
+
+    int m_vsyncEventFd;
+    HwComposerVSyncNotifier *m_vsyncNotifier;
+    qint64 m_vsyncRing[VSyncRingSize];
+    QAtomicInt m_vsyncHead;
+    QAtomicInt m_vsyncTail;
+
+    QMutex m_renderTimeMutex;
+    QHash<QWindow *, RenderTime> m_renderTimes;
+};
+
+#endif /* HWCOMPOSER_FRAME_SCHEDULER_H */
@@ -0,0 +1,219 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "hwcomposer_present_thread.h"
+
+#ifdef HWC_PLUGIN_HAVE_HWCOMPOSER1_API
+
+#include "qsystrace_selector.h"
+
+#include <QtDebug>
+
+#include <sync/sync.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+HwComposerPresentThread::HwComposerPresentThread()
+    : m_head(0)
+    , m_count(0)
+    , m_committing(0)
+    , m_quit(false)
+    , m_epollFd(epoll_create1(EPOLL_CLOEXEC))
+    , m_wakeupFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    , m_pendingFenceCount(0)
+{
+    if (m_epollFd == -1 || m_wakeupFd == -1)
+        qFatal("QPA-HWC: could not create the present thread wakeup fds in %s", __func__);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = m_wakeupFd;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeupFd, &event) != 0)
+        qFatal("QPA-HWC: epoll_ctl() failed in %s", __func__);
+
+    setObjectName(QStringLiteral("QPA-HWC present"));
+    start(QThread::HighestPriority);
+}
+
+HwComposerPresentThread::~HwComposerPresentThread()
+{
+    stop();
+
+    for (int i = 0; i < m_pendingFenceCount; ++i)
+        close(m_pendingFences[i]);
+
+    close(m_wakeupFd);
+    close(m_epollFd);
+}
+
+void HwComposerPresentThread::stop()
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        m_quit = true;
+    }
+    wakeUp();
+    wait();
+}
+
+void HwComposerPresentThread::wakeUp()
+{
+    const uint64_t one = 1;
+    if (write(m_wakeupFd, &one, sizeof(one)) != sizeof(one)) {
+        // Only fails if the counter would overflow, the thread is awake
+        // anyway in that case.
+    }
+}
+
+void HwComposerPresentThread::queue(Target *target, HWComposerNativeWindowBuffer *buffer, int acquireFenceFd, const QRegion &damage)
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        while (m_count == QueueSize)
+            m_cond.wait(&m_mutex);
+
+        Command &command = m_queue[(m_head + m_count) % QueueSize];
+        command.target = target;
+        command.buffer = buffer;
+        command.acquireFenceFd = acquireFenceFd;
+        command.damage = damage;
+        ++m_count;
+    }
+    wakeUp();
+}
+
+void HwComposerPresentThread::waitForCommitted(int maxInFlight)
+{
+    QMutexLocker lock(&m_mutex);
+    while (m_count + m_committing > maxInFlight)
+        m_cond.wait(&m_mutex);
+}
+
+bool HwComposerPresentThread::takeCommand(Command *command)
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_count == 0)
+        return false;
+
+    *command = m_queue[m_head];
+    m_queue[m_head].damage = QRegion();
+    m_head = (m_head + 1) % QueueSize;
+    --m_count;
+    // Still counts as in flight until committed, see waitForCommitted()
+    ++m_committing;
+    return true;
+}
+
+void HwComposerPresentThread::retireFence(int fenceFd)
+{
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fenceFd, NULL);
+    close(fenceFd);
+
+    for (int i = 0; i < m_pendingFenceCount; ++i) {
+        if (m_pendingFences[i] == fenceFd) {
+            m_pendingFences[i] = m_pendingFences[--m_pendingFenceCount];
+            break;
+        }
+    }
+}
+
+void HwComposerPresentThread::run()
+{
+    struct epoll_event events[1 + MaxPendingFences];
+
+    for (;;) {
+        // Commit as many frames as the fence budget allows
+        while (m_pendingFenceCount < MaxPendingFences) {
+            Command command;
+            if (!takeCommand(&command))
+                break;
+
+            int presentFenceFd = command.target->commit(command.buffer, command.acquireFenceFd, command.damage);
+
+            {
+                QMutexLocker lock(&m_mutex);
+                --m_committing;
+                m_cond.wakeAll();
+            }
+
+            if (presentFenceFd == -1)
+                continue;
+
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = presentFenceFd;
+            if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, presentFenceFd, &event) != 0) {
+                // Not pollable, fall back to a blocking wait
+                sync_wait(presentFenceFd, -1);
+                close(presentFenceFd);
+                continue;
+            }
+            m_pendingFences[m_pendingFenceCount++] = presentFenceFd;
+        }
+
+        {
+            QMutexLocker lock(&m_mutex);
+            if (m_quit && m_count == 0)
+                break;
+        }
+
+        int n = epoll_wait(m_epollFd, events, 1 + MaxPendingFences, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            qFatal("QPA-HWC: epoll_wait() in %s failed: %d", __func__, errno);
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.fd == m_wakeupFd) {
+                uint64_t count;
+                if (read(m_wakeupFd, &count, sizeof(count)) != sizeof(count)) {
+                    // Spurious wakeup, nothing to consume
+                }
+            } else {
+                QSystraceEvent trace("graphics", "QPA::retire");
+                retireFence(events[i].data.fd);
+            }
+        }
+    }
+}
+
+#endif /* HWC_PLUGIN_HAVE_HWCOMPOSER1_API */
@@ -0,0 +1,120 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef HWCOMPOSER_PRESENT_THREAD_H
+#define HWCOMPOSER_PRESENT_THREAD_H
+
+#ifdef HWC_PLUGIN_HAVE_HWCOMPOSER1_API
+
+// libhybris access to the native hwcomposer window
+#include <hwcomposer_window.h>
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QRegion>
+
+// Takes presentation off the render thread. Frames queued from within
+// eglSwapBuffers are committed to the hwcomposer from this thread, and the
+// present fences they return are retired here as they signal, so that the
+// render thread can start on the next frame right away.
+class HwComposerPresentThread : public QThread
+{
+public:
+    class Target {
+    public:
+        virtual ~Target() {}
+
+        // Called on the present thread. Hands the buffer to the hwcomposer,
+        // consuming acquireFenceFd, and returns a fence that signals once
+        // the frame is on screen, or -1. damage is what changed since the
+        // previous buffer, empty if everything did.
+        virtual int commit(HWComposerNativeWindowBuffer *buffer, int acquireFenceFd, const QRegion &damage) = 0;
+    };
+
+    HwComposerPresentThread();
+    ~HwComposerPresentThread();
+
+    // Blocks while the command queue is full
+    void queue(Target *target, HWComposerNativeWindowBuffer *buffer, int acquireFenceFd, const QRegion &damage);
+
+    // Blocks until no more than maxInFlight queued frames are still waiting
+    // to be committed.
+    void waitForCommitted(int maxInFlight);
+
+    void stop();
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    enum {
+        QueueSize = 8,
+        // Like a synchronous present that waits for the previous frame's
+        // fence, allow one frame on screen and one on its way there.
+        MaxPendingFences = 2
+    };
+
+    struct Command {
+        Target *target;
+        HWComposerNativeWindowBuffer *buffer;
+        int acquireFenceFd;
+        QRegion damage;
+    };
+
+    void wakeUp();
+    bool takeCommand(Command *command);
+    void retireFence(int fenceFd);
+
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    Command m_queue[QueueSize];
+    int m_head;
+    int m_count;
+    int m_committing;
+    bool m_quit;
+
+    int m_epollFd;
+    int m_wakeupFd;
+    int m_pendingFences[MaxPendingFences];
+    int m_pendingFenceCount;
+};
+
+#endif /* HWC_PLUGIN_HAVE_HWCOMPOSER1_API */
+
+#endif /* HWCOMPOSER_PRESENT_THREAD_H */
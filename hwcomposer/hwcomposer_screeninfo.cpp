@@ -104,32 +104,21 @@ public:
 
 
 
-// Framebuffer device source: Try to read values from fbdev
+// Framebuffer device source: Try to read values from fbdev, only once it
+// turns out to be needed
 
 class HwComposerScreenInfoFbDevSource {
 public:
     HwComposerScreenInfoFbDevSource()
-        : m_valid(false)
+        : m_probed(false)
+        , m_valid(false)
     {
-        const char *FRAMEBUFFER_DEVICE_NAME = "/dev/fb0";
-
-        // Query variable screen information from framebuffer
-        int framebuffer = qt_safe_open(FRAMEBUFFER_DEVICE_NAME, O_RDONLY);
-        if (framebuffer != -1) {
-            if (ioctl(framebuffer, FBIOGET_VSCREENINFO, &m_vinfo) != -1) {
-                m_valid = true;
-            } else {
-                qWarning("EGLFS: Could not query variable screen info from %s",
-                        FRAMEBUFFER_DEVICE_NAME);
-            }
-            close(framebuffer);
-        } else {
-            qWarning("EGLFS: Failed to open %s", FRAMEBUFFER_DEVICE_NAME);
-        }
     }
 
     bool isValid()
     {
+        if (!m_probed)
+            probe();
         return m_valid;
     }
 
@@ -149,7 +138,29 @@ public:
     }
 
 private:
+    void probe()
+    {
+        const char *FRAMEBUFFER_DEVICE_NAME = "/dev/fb0";
+
+        m_probed = true;
+
+        // Query variable screen information from framebuffer
+        int framebuffer = qt_safe_open(FRAMEBUFFER_DEVICE_NAME, O_RDONLY);
+        if (framebuffer != -1) {
+            if (ioctl(framebuffer, FBIOGET_VSCREENINFO, &m_vinfo) != -1) {
+                m_valid = true;
+            } else {
+                qWarning("EGLFS: Could not query variable screen info from %s",
+                        FRAMEBUFFER_DEVICE_NAME);
+            }
+            close(framebuffer);
+        } else {
+            qWarning("EGLFS: Failed to open %s", FRAMEBUFFER_DEVICE_NAME);
+        }
+    }
+
     struct fb_var_screeninfo m_vinfo;
+    bool m_probed;
     bool m_valid;
 };
 
@@ -206,11 +217,16 @@ private:
     int m_depth;
 };
 
+// Hwcomposer source: Ask the backend, only once it turns out to be needed
+
 class HwComposerScreenInfoHWCSource {
 public:
-    HwComposerScreenInfoHWCSource(HwComposerBackend *backend) {
-        m_have_values = backend->getScreenSizes(&m_width, &m_height, &m_physicalWidth, &m_physicalHeight);
-        m_depth = 32;
+    HwComposerScreenInfoHWCSource(HwComposerBackend *backend)
+        : m_backend(backend)
+        , m_depth(32)
+        , m_probed(false)
+        , m_have_values(false)
+    {
     }
 
     QSizeF physicalScreenSize()
@@ -230,15 +246,21 @@ public:
 
     bool isValid()
     {
+        if (!m_probed) {
+            m_have_values = m_backend->getScreenSizes(&m_width, &m_height, &m_physicalWidth, &m_physicalHeight);
+            m_probed = true;
+        }
         return m_have_values;
     }
 
 private:
+    HwComposerBackend *m_backend;
     float m_physicalWidth;
     float m_physicalHeight;
     int m_width;
     int m_height;
     int m_depth;
+    bool m_probed;
     bool m_have_values;
 };
 
@@ -0,0 +1,222 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "hwcomposer_startup.h"
+#include "hwcomposer_backend.h"
+#include "hwcomposer_screeninfo.h"
+#include "hwcomposer_trace.h"
+#include "qsystrace_selector.h"
+
+#include <QtCore/QThread>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QList>
+
+QT_BEGIN_NAMESPACE
+
+#define PHASE_BIT(phase) (1u << (phase))
+
+static const struct {
+    const char *name;
+    unsigned dependsOn;
+    // Creates QObjects that have to live on the GUI thread
+    bool guiThread;
+} phases[HwComposerStartup::PhaseCount] = {
+    { "framebuffer-first", 0, false },
+    { "mini-surfaceflinger", 0, false },
+    { "open-device",
+      PHASE_BIT(HwComposerStartup::FramebufferFirst) | PHASE_BIT(HwComposerStartup::MiniSurfaceFlinger), false },
+    { "create-backend", PHASE_BIT(HwComposerStartup::OpenDevice), true },
+    // Waits for the display, which EGL does not need
+    { "screen-info", PHASE_BIT(HwComposerStartup::CreateBackend), true },
+    { "egl-initialize", PHASE_BIT(HwComposerStartup::CreateBackend), false },
+};
+
+class HwComposerStartup::PhaseThread : public QThread
+{
+public:
+    PhaseThread(HwComposerStartup *startup, Phase phase)
+        : m_startup(startup), m_phase(phase)
+    {
+        setObjectName(QString::fromLatin1(phases[phase].name));
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE { m_startup->runPhase(m_phase); }
+
+private:
+    HwComposerStartup *m_startup;
+    Phase m_phase;
+};
+
+HwComposerStartup::HwComposerStartup()
+    : m_started(0)
+    , m_done(0)
+    , m_libminisf(NULL)
+    , m_module(NULL)
+    , m_device(NULL)
+    , m_backend(NULL)
+    , m_screenInfo(NULL)
+    , m_eglDisplay(EGL_NO_DISPLAY)
+{
+    for (int i = 0; i < PhaseCount; ++i) {
+        m_startedAt[i] = 0;
+        m_doneAt[i] = 0;
+        m_onThread[i] = false;
+    }
+}
+
+bool HwComposerStartup::isReady(Phase phase) const
+{
+    return !(m_started & PHASE_BIT(phase))
+        && (m_done & phases[phase].dependsOn) == phases[phase].dependsOn;
+}
+
+void HwComposerStartup::run()
+{
+    const bool serial = qgetenv("QPA_HWC_WORKAROUNDS").split(',').contains("serial-startup");
+    const unsigned all = PHASE_BIT(PhaseCount) - 1;
+
+    QVarLengthArray<PhaseThread *, PhaseCount> threads;
+
+    if (qgetenv("QPA_HWC_TRACE") == "1")
+        HwComposerTrace::setEnabled(true);
+
+    m_timer.start();
+
+    QMutexLocker lock(&m_mutex);
+    while (m_done != all) {
+        Phase next = PhaseCount;
+        for (int i = 0; i < PhaseCount; ++i) {
+            const Phase phase = Phase(i);
+            if (!isReady(phase))
+                continue;
+
+            if (serial || phases[phase].guiThread) {
+                if (next == PhaseCount)
+                    next = phase;
+                continue;
+            }
+
+            m_started |= PHASE_BIT(phase);
+            m_onThread[phase] = true;
+            PhaseThread *thread = new PhaseThread(this, phase);
+            threads.append(thread);
+            thread->start();
+        }
+
+        if (next != PhaseCount) {
+            m_started |= PHASE_BIT(next);
+            lock.unlock();
+            runPhase(next);
+            lock.relock();
+        } else if (m_done != all) {
+            m_cond.wait(&m_mutex);
+        }
+    }
+    lock.unlock();
+
+    for (int i = 0; i < threads.size(); ++i) {
+        threads[i]->wait();
+        delete threads[i];
+    }
+
+    report();
+}
+
+void HwComposerStartup::runPhase(Phase phase)
+{
+    QSystraceEvent trace("graphics", phases[phase].name);
+    const qint64 startedAt = m_timer.nsecsElapsed();
+
+    switch (phase) {
+    case FramebufferFirst:
+        HwComposerBackend::openFramebufferFirst();
+        break;
+    case MiniSurfaceFlinger:
+        m_libminisf = HwComposerBackend::startMiniSurfaceFlinger();
+        break;
+    case OpenDevice:
+        HwComposerBackend::openDevice(&m_module, &m_device);
+        break;
+    case CreateBackend:
+        // This actually opens the hwcomposer device
+        m_backend = HwComposerBackend::create(m_module, m_device, m_libminisf);
+        HWC_PLUGIN_ASSERT_NOT_NULL(m_backend);
+        break;
+    case ScreenInfo:
+        m_screenInfo = new HwComposerScreenInfo(m_backend);
+        break;
+    case EglInitialize: {
+        EGLint major, minor;
+
+        m_eglDisplay = eglGetDisplay(m_backend->display());
+        if (m_eglDisplay == EGL_NO_DISPLAY) {
+            qWarning("Could not open egl display\n");
+            qFatal("EGL error");
+        }
+
+        if (!eglInitialize(m_eglDisplay, &major, &minor)) {
+            qWarning("Could not initialize egl display\n");
+            qFatal("EGL error");
+        }
+        break;
+    }
+    case PhaseCount:
+        break;
+    }
+
+    QMutexLocker lock(&m_mutex);
+    m_startedAt[phase] = startedAt;
+    m_doneAt[phase] = m_timer.nsecsElapsed();
+    m_done |= PHASE_BIT(phase);
+    m_cond.wakeAll();
+}
+
+void HwComposerStartup::report() const
+{
+    qDebug("QPA-HWC: startup took %.1f ms", m_timer.nsecsElapsed() / 1e6);
+    for (int i = 0; i < PhaseCount; ++i) {
+        qDebug("QPA-HWC:   %-20s %7.1f ms, from %7.1f to %7.1f ms on the %s thread",
+               phases[i].name,
+               (m_doneAt[i] - m_startedAt[i]) / 1e6,
+               m_startedAt[i] / 1e6, m_doneAt[i] / 1e6,
+               m_onThread[i] ? "startup" : "GUI");
+    }
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,112 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef HWCOMPOSER_STARTUP_H
+#define HWCOMPOSER_STARTUP_H
+
+#include <QtGlobal>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QElapsedTimer>
+
+#include <EGL/egl.h>
+
+struct hw_module_t;
+struct hw_device_t;
+
+QT_BEGIN_NAMESPACE
+
+class HwComposerBackend;
+class HwComposerScreenInfo;
+
+// Brings up the hwcomposer and EGL as a set of phases, each of which runs
+// as soon as the phases it depends on are done. Phases that create
+// objects living on the GUI thread run on the calling thread, the others
+// on threads of their own. How long each phase took is printed once all
+// are done. QPA_HWC_WORKAROUNDS=serial-startup runs them one after the
+// other on the calling thread instead.
+class HwComposerStartup
+{
+public:
+    enum Phase {
+        FramebufferFirst,
+        MiniSurfaceFlinger,
+        OpenDevice,
+        CreateBackend,
+        ScreenInfo,
+        EglInitialize,
+        PhaseCount
+    };
+
+    HwComposerStartup();
+
+    void run();
+
+    // Owned by the caller after run()
+    HwComposerBackend *backend() const { return m_backend; }
+    HwComposerScreenInfo *screenInfo() const { return m_screenInfo; }
+    EGLDisplay eglDisplay() const { return m_eglDisplay; }
+
+private:
+    class PhaseThread;
+
+    void runPhase(Phase phase);
+    bool isReady(Phase phase) const;
+    void report() const;
+
+    QElapsedTimer m_timer;
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    // Bit masks of phases
+    unsigned m_started;
+    unsigned m_done;
+    qint64 m_startedAt[PhaseCount];
+    qint64 m_doneAt[PhaseCount];
+    bool m_onThread[PhaseCount];
+
+    void *m_libminisf;
+    hw_module_t *m_module;
+    hw_device_t *m_device;
+    HwComposerBackend *m_backend;
+    HwComposerScreenInfo *m_screenInfo;
+    EGLDisplay m_eglDisplay;
+};
+
+QT_END_NAMESPACE
+
+#endif /* HWCOMPOSER_STARTUP_H */
@@ -0,0 +1,325 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "hwcomposer_stats.h"
+#include "hwcomposer_trace.h"
+
+#include <QtDBus/QDBusConnection>
+#include <QtCore/QCoreApplication>
+#include <QtDebug>
+
+#include <time.h>
+
+static const char *STATS_SERVICE_PREFIX = "org.hwcomposer.qpa.pid";
+static const char *STATS_PATH = "/org/hwcomposer/qpa/Stats";
+
+static qint64 clockNs(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void HwComposerStats::Timer::restart()
+{
+    m_wall = clockNs(CLOCK_MONOTONIC);
+    m_cpu = clockNs(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void HwComposerStats::Timer::lap(Stage stage)
+{
+    const qint64 wall = clockNs(CLOCK_MONOTONIC);
+    const qint64 cpu = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    HwComposerStats::instance()->record(stage, wall - m_wall, cpu - m_cpu);
+    m_wall = wall;
+    m_cpu = cpu;
+}
+
+HwComposerStats::HwComposerStats()
+{
+    reset();
+}
+
+HwComposerStats *HwComposerStats::instance()
+{
+    static HwComposerStats stats;
+    return &stats;
+}
+
+int HwComposerStats::bucketIndex(qint64 us)
+{
+    if (us < 4)
+        return us < 0 ? 0 : int(us);
+
+    const int msb = 63 - __builtin_clzll(quint64(us));
+    const int index = 4 * (msb - 1) + int((us >> (msb - 2)) & 3);
+    return qMin(index, int(BucketCount) - 1);
+}
+
+qint64 HwComposerStats::bucketLowerBound(int index)
+{
+    if (index < 4)
+        return index;
+
+    const int msb = index / 4 + 1;
+    return qint64(4 + index % 4) << (msb - 2);
+}
+
+void HwComposerStats::record(Stage stage, qint64 wallNs, qint64 cpuNs)
+{
+    Histogram &histogram = m_histograms[stage];
+    histogram.buckets[bucketIndex(wallNs / 1000)].fetchAndAddRelaxed(1);
+    histogram.count.fetchAndAddRelaxed(1);
+    histogram.wallSum.fetchAndAddRelaxed(wallNs);
+    histogram.cpuSum.fetchAndAddRelaxed(cpuNs);
+}
+
+void HwComposerStats::reset()
+{
+    // Not atomic as a whole, a frame recorded meanwhile may be half counted
+    for (int stage = 0; stage < StageCount; ++stage) {
+        Histogram &histogram = m_histograms[stage];
+        for (int i = 0; i < BucketCount; ++i)
+            histogram.buckets[i].store(0);
+        histogram.count.store(0);
+        histogram.wallSum.store(0);
+        histogram.cpuSum.store(0);
+    }
+    for (int event = 0; event < VSyncEventCount; ++event)
+        m_vsyncEvents[event].store(0);
+}
+
+const char *HwComposerStats::stageName(Stage stage)
+{
+    switch (stage) {
+    case Dequeue:
+        return "dequeue";
+    case AcquireFenceWait:
+        return "acquire-fence-wait";
+    case Prepare:
+        return "prepare";
+    case Present:
+        return "present";
+    case RetireFenceWait:
+        return "retire-fence-wait";
+    case Swap:
+        return "swap";
+    case StageCount:
+        break;
+    }
+    return "unknown";
+}
+
+qint64 HwComposerStats::percentile(Stage stage, int permille) const
+{
+    const Histogram &histogram = m_histograms[stage];
+
+    qint64 total = 0;
+    int counts[BucketCount];
+    for (int i = 0; i < BucketCount; ++i) {
+        counts[i] = histogram.buckets[i].load();
+        total += counts[i];
+    }
+    if (!total)
+        return 0;
+
+    const qint64 rank = (total * permille + 999) / 1000;
+    qint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += counts[i];
+        if (seen >= rank)
+            return i + 1 < BucketCount ? bucketLowerBound(i + 1) : bucketLowerBound(i);
+    }
+    return bucketLowerBound(BucketCount - 1);
+}
+
+QVariantMap HwComposerStats::stageSummary(Stage stage) const
+{
+    const Histogram &histogram = m_histograms[stage];
+    const int count = histogram.count.load();
+
+    // Percentiles are upper bounds of the bucket they fall into, in us
+    QVariantMap summary;
+    summary.insert(QStringLiteral("count"), count);
+    summary.insert(QStringLiteral("mean_us"), count ? histogram.wallSum.load() / 1000 / count : 0);
+    summary.insert(QStringLiteral("cpu_mean_us"), count ? histogram.cpuSum.load() / 1000 / count : 0);
+    summary.insert(QStringLiteral("p50_us"), percentile(stage, 500));
+    summary.insert(QStringLiteral("p90_us"), percentile(stage, 900));
+    summary.insert(QStringLiteral("p99_us"), percentile(stage, 990));
+    summary.insert(QStringLiteral("max_us"), percentile(stage, 1000));
+    return summary;
+}
+
+QString HwComposerStats::report() const
+{
+    QString report = QStringLiteral("stage                    count     mean      cpu      p50      p90      p99      max (us)\n");
+    for (int stage = 0; stage < StageCount; ++stage) {
+        const QVariantMap summary = stageSummary(Stage(stage));
+        report += QString::fromLatin1("%1 %2 %3 %4 %5 %6 %7 %8\n")
+            .arg(QLatin1String(stageName(Stage(stage))), -20)
+            .arg(summary.value(QStringLiteral("count")).toInt(), 9)
+            .arg(summary.value(QStringLiteral("mean_us")).toLongLong(), 8)
+            .arg(summary.value(QStringLiteral("cpu_mean_us")).toLongLong(), 8)
+            .arg(summary.value(QStringLiteral("p50_us")).toLongLong(), 8)
+            .arg(summary.value(QStringLiteral("p90_us")).toLongLong(), 8)
+            .arg(summary.value(QStringLiteral("p99_us")).toLongLong(), 8)
+            .arg(summary.value(QStringLiteral("max_us")).toLongLong(), 8);
+    }
+
+    const QVariantMap vsync = vsyncSummary();
+    report += QString::fromLatin1("vsync: %1 requests, enabled %2 times, disabled %3 times, %4 bounces, linger %5 ms\n")
+        .arg(vsync.value(QStringLiteral("requests")).toInt())
+        .arg(vsync.value(QStringLiteral("enables")).toInt())
+        .arg(vsync.value(QStringLiteral("disables")).toInt())
+        .arg(vsync.value(QStringLiteral("bounces")).toInt())
+        .arg(vsync.value(QStringLiteral("linger_ms")).toInt());
+
+    const QVariantMap policy = fencePolicy();
+    if (!policy.isEmpty()) {
+        report += QString::fromLatin1("fence policy: %1%2\n")
+            .arg(policy.value(QStringLiteral("policy")).toString())
+            .arg(policy.value(QStringLiteral("pinned")).toBool() ? QStringLiteral(" (pinned)")
+                 : policy.value(QStringLiteral("exploring")).toBool() ? QStringLiteral(" (exploring)")
+                 : QString());
+    }
+    return report;
+}
+
+QVariantMap HwComposerStats::vsyncSummary() const
+{
+    QVariantMap summary;
+    summary.insert(QStringLiteral("requests"), m_vsyncEvents[VSyncRequest].load());
+    summary.insert(QStringLiteral("enables"), m_vsyncEvents[VSyncEnable].load());
+    summary.insert(QStringLiteral("disables"), m_vsyncEvents[VSyncDisable].load());
+    summary.insert(QStringLiteral("bounces"), m_vsyncEvents[VSyncBounce].load());
+    summary.insert(QStringLiteral("linger_ms"), m_vsyncLingerTime.load());
+    return summary;
+}
+
+void HwComposerStats::setFencePolicy(const QVariantMap &summary)
+{
+    QMutexLocker lock(&m_fencePolicyMutex);
+    m_fencePolicy = summary;
+}
+
+QVariantMap HwComposerStats::fencePolicy() const
+{
+    QMutexLocker lock(&m_fencePolicyMutex);
+    return m_fencePolicy;
+}
+
+HwComposerStatsAdaptor::HwComposerStatsAdaptor(QObject *parent)
+    : QObject(parent)
+    , m_registered(false)
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    if (!bus.isConnected()) {
+        qDebug("QPA-HWC: no session bus, frame statistics are not exported");
+        return;
+    }
+
+    m_registered = bus.registerObject(QLatin1String(STATS_PATH), this, QDBusConnection::ExportAllSlots);
+    if (!m_registered) {
+        qWarning("QPA-HWC: could not export frame statistics on %s", STATS_PATH);
+        return;
+    }
+
+    // Each process has its own name, the statistics are still reachable
+    // through the unique connection name if the bus refuses it
+    const QString service = QLatin1String(STATS_SERVICE_PREFIX) + QString::number(QCoreApplication::applicationPid());
+    if (bus.registerService(service))
+        m_service = service;
+    qDebug("QPA-HWC: frame statistics exported on %s at %s",
+           qPrintable(m_service.isEmpty() ? bus.baseService() : m_service), STATS_PATH);
+}
+
+HwComposerStatsAdaptor::~HwComposerStatsAdaptor()
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    if (!m_service.isEmpty())
+        bus.unregisterService(m_service);
+    if (m_registered)
+        bus.unregisterObject(QLatin1String(STATS_PATH));
+}
+
+QStringList HwComposerStatsAdaptor::Stages() const
+{
+    QStringList stages;
+    for (int stage = 0; stage < HwComposerStats::StageCount; ++stage)
+        stages << QLatin1String(HwComposerStats::stageName(HwComposerStats::Stage(stage)));
+    return stages;
+}
+
+QVariantMap HwComposerStatsAdaptor::Stage(const QString &name) const
+{
+    for (int stage = 0; stage < HwComposerStats::StageCount; ++stage) {
+        if (name == QLatin1String(HwComposerStats::stageName(HwComposerStats::Stage(stage))))
+            return HwComposerStats::instance()->stageSummary(HwComposerStats::Stage(stage));
+    }
+    return QVariantMap();
+}
+
+QString HwComposerStatsAdaptor::Report() const
+{
+    return HwComposerStats::instance()->report();
+}
+
+void HwComposerStatsAdaptor::Reset()
+{
+    HwComposerStats::instance()->reset();
+}
+
+QVariantMap HwComposerStatsAdaptor::VSync() const
+{
+    return HwComposerStats::instance()->vsyncSummary();
+}
+
+QVariantMap HwComposerStatsAdaptor::FencePolicy() const
+{
+    return HwComposerStats::instance()->fencePolicy();
+}
+
+bool HwComposerStatsAdaptor::Tracing() const
+{
+    return HwComposerTrace::isEnabled();
+}
+
+bool HwComposerStatsAdaptor::SetTracing(bool enabled)
+{
+    return HwComposerTrace::setEnabled(enabled);
+}
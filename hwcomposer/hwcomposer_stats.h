@@ -0,0 +1,171 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef HWCOMPOSER_STATS_H
+#define HWCOMPOSER_STATS_H
+
+#include <QtGlobal>
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QVariantMap>
+
+// Latency histograms of the stages a frame goes through on its way to the
+// display, and counters of how hardware vsync is toggled. Recording is lock-free and cheap enough to be left enabled on
+// production devices. With QPA_HWC_STATS=1 in the environment of a process,
+// the results can be pulled over the session bus from the name of that
+// process:
+//
+//   gdbus call --session --dest org.hwcomposer.qpa.pid<PID> \
+//       --object-path /org/hwcomposer/qpa/Stats \
+//       --method org.hwcomposer.qpa.Stats.Report
+//
+// The same interface switches the trace_marker events of HwComposerTrace
+// on and off with SetTracing.
+class HwComposerStats
+{
+public:
+    enum Stage {
+        Dequeue,
+        AcquireFenceWait,
+        Prepare,
+        Present,
+        RetireFenceWait,
+        Swap,
+        StageCount
+    };
+
+    // What HwComposerVSyncSource does with the hardware vsync events
+    enum VSyncEvent {
+        VSyncRequest,
+        VSyncEnable,
+        VSyncDisable,
+        // Enabled again shortly after the linger time ran out
+        VSyncBounce,
+        VSyncEventCount
+    };
+
+    // Measures consecutive stages on the calling thread, both in wall
+    // clock and in CPU time of the thread
+    class Timer
+    {
+    public:
+        Timer() { restart(); }
+        void restart();
+        // Records the time since the last lap or restart
+        void lap(Stage stage);
+
+    private:
+        qint64 m_wall;
+        qint64 m_cpu;
+    };
+
+    static HwComposerStats *instance();
+
+    void record(Stage stage, qint64 wallNs, qint64 cpuNs);
+    void reset();
+
+    static const char *stageName(Stage stage);
+    QVariantMap stageSummary(Stage stage) const;
+    QString report() const;
+
+    void count(VSyncEvent event) { m_vsyncEvents[event].fetchAndAddRelaxed(1); }
+    void setVSyncLingerTime(int ms) { m_vsyncLingerTime.store(ms); }
+    QVariantMap vsyncSummary() const;
+
+    // The fence policy in use on the primary display and how the
+    // candidates scored, see HwComposerFencePolicy
+    void setFencePolicy(const QVariantMap &summary);
+    QVariantMap fencePolicy() const;
+
+private:
+    HwComposerStats();
+
+    enum {
+        // Four buckets per power of two microseconds, up to about a minute
+        BucketCount = 104
+    };
+
+    static int bucketIndex(qint64 us);
+    static qint64 bucketLowerBound(int index);
+    qint64 percentile(Stage stage, int permille) const;
+
+    struct Histogram {
+        QAtomicInt buckets[BucketCount];
+        QAtomicInt count;
+        QAtomicInteger<qint64> wallSum;
+        QAtomicInteger<qint64> cpuSum;
+    };
+
+    Histogram m_histograms[StageCount];
+
+    QAtomicInt m_vsyncEvents[VSyncEventCount];
+    QAtomicInt m_vsyncLingerTime;
+
+    mutable QMutex m_fencePolicyMutex;
+    QVariantMap m_fencePolicy;
+};
+
+class HwComposerStatsAdaptor : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.hwcomposer.qpa.Stats")
+
+public:
+    explicit HwComposerStatsAdaptor(QObject *parent = 0);
+    ~HwComposerStatsAdaptor();
+
+public Q_SLOTS:
+    QStringList Stages() const;
+    QVariantMap Stage(const QString &name) const;
+    QString Report() const;
+    void Reset();
+    QVariantMap VSync() const;
+    QVariantMap FencePolicy() const;
+    bool Tracing() const;
+    bool SetTracing(bool enabled);
+
+private:
+    bool m_registered;
+    // Per process, empty unless registered
+    QString m_service;
+};
+
+#endif /* HWCOMPOSER_STATS_H */
@@ -0,0 +1,146 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "hwcomposer_trace.h"
+
+#include <QtCore/QMutex>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+QBasicAtomicInt HwComposerTrace::s_enabled = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+// Opened once, and kept open so that events racing with a switch off
+// never write to a closed descriptor
+static QBasicAtomicInt traceMarkerFd = Q_BASIC_ATOMIC_INITIALIZER(-1);
+static QBasicMutex traceMarkerMutex;
+
+static int openTraceMarker()
+{
+    static const char *paths[] = {
+        "/sys/kernel/tracing/trace_marker",
+        "/sys/kernel/debug/tracing/trace_marker",
+    };
+
+    for (unsigned i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+        int fd = ::open(paths[i], O_WRONLY | O_CLOEXEC);
+        if (fd != -1)
+            return fd;
+    }
+    return -1;
+}
+
+bool HwComposerTrace::setEnabled(bool enabled)
+{
+    if (enabled) {
+        QMutexLocker lock(&traceMarkerMutex);
+        if (traceMarkerFd.load() == -1) {
+            int fd = openTraceMarker();
+            if (fd == -1) {
+                qWarning("QPA-HWC: could not open the trace_marker, tracing stays off");
+                return false;
+            }
+            traceMarkerFd.storeRelease(fd);
+        }
+    }
+
+    s_enabled.storeRelease(enabled);
+    return true;
+}
+
+static void writeEvent(char type, const char *name, const char *message)
+{
+    const int fd = traceMarkerFd.loadAcquire();
+    if (fd == -1)
+        return;
+
+    static const int pid = getpid();
+
+    // One write per event, the kernel keeps it in one piece
+    char buffer[512];
+    int length;
+    if (!name)
+        length = snprintf(buffer, sizeof(buffer), "%c|%d", type, pid);
+    else if (!*message)
+        length = snprintf(buffer, sizeof(buffer), "%c|%d|%s", type, pid, name);
+    else if (type == 'C')
+        length = snprintf(buffer, sizeof(buffer), "%c|%d|%s|%s", type, pid, name, message);
+    else
+        length = snprintf(buffer, sizeof(buffer), "%c|%d|%s %s", type, pid, name, message);
+
+    if (length <= 0)
+        return;
+    if (length >= int(sizeof(buffer)))
+        length = sizeof(buffer) - 1;
+
+    // Events are best effort, a lost one only leaves a gap in the trace.
+    // A descriptor that stopped working will not come back though.
+    if (::write(fd, buffer, length) < 0 && errno == EBADF) {
+        qWarning("QPA-HWC: could not write to the trace_marker, tracing is now off");
+        HwComposerTrace::setEnabled(false);
+    }
+}
+
+static void formatMessage(char *message, size_t size, const char *format, va_list args)
+{
+    if (format && *format)
+        vsnprintf(message, size, format, args);
+    else
+        message[0] = '\0';
+}
+
+void HwComposerTrace::begin(const char *name, const char *format, va_list args)
+{
+    char message[256];
+    formatMessage(message, sizeof(message), format, args);
+    writeEvent('B', name, message);
+}
+
+void HwComposerTrace::end()
+{
+    writeEvent('E', NULL, NULL);
+}
+
+void HwComposerTrace::counter(const char *name, const char *format, va_list args)
+{
+    char message[64];
+    formatMessage(message, sizeof(message), format, args);
+    writeEvent('C', name, message);
+}
@@ -0,0 +1,68 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef HWCOMPOSER_TRACE_H
+#define HWCOMPOSER_TRACE_H
+
+#include <QtCore/QAtomicInt>
+
+#include <stdarg.h>
+
+// Begin, end and counter events in the systrace format that Perfetto and
+// systrace read, written to the ftrace trace_marker. Off by default, set
+// QPA_HWC_TRACE=1 to have it on from the start, or switch it over the
+// org.hwcomposer.qpa.Stats D-Bus interface. While off, an event costs a
+// relaxed atomic load.
+class HwComposerTrace
+{
+public:
+    static bool isEnabled() { return s_enabled.load(); }
+    // Returns false if the trace_marker can not be opened
+    static bool setEnabled(bool enabled);
+
+    // name and the message printed from format make the slice name
+    static void begin(const char *name, const char *format, va_list args);
+    static void end();
+    // message is the counter value
+    static void counter(const char *name, const char *format, va_list args);
+
+private:
+    static QBasicAtomicInt s_enabled;
+};
+
+#endif /* HWCOMPOSER_TRACE_H */
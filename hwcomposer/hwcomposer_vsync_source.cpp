@@ -0,0 +1,157 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "hwcomposer_vsync_source.h"
+#include "hwcomposer_stats.h"
+
+#include <QtCore/QTimerEvent>
+#include <QtCore/QLoggingCategory>
+#include <QtDebug>
+
+// Off unless enabled with QT_LOGGING_RULES="qt.qpa.hwc.vsync.debug=true"
+Q_LOGGING_CATEGORY(lcVSyncSource, "qt.qpa.hwc.vsync", QtWarningMsg)
+
+// Bounds for how long vsync stays enabled after the last update request, in ms
+static const int MIN_LINGER_TIME = 50;
+static const int MAX_LINGER_TIME = 800;
+
+// After being off for this long, the next burst is considered unrelated to
+// the previous one and the linger time decays back towards the minimum.
+static const int IDLE_DECAY_TIME = 2000;
+
+HwComposerVSyncSource::HwComposerVSyncSource()
+    : m_state(Off)
+    , m_lingerTime(MIN_LINGER_TIME)
+    , m_lastRequest(0)
+    , m_disabledAt(-1)
+    , m_requestCount(0)
+    , m_enableCount(0)
+    , m_disableCount(0)
+    , m_bounceCount(0)
+{
+    m_clock.start();
+    HwComposerStats::instance()->setVSyncLingerTime(m_lingerTime);
+}
+
+HwComposerVSyncSource::~HwComposerVSyncSource()
+{
+    qCDebug(lcVSyncSource, "QPA-HWC: vsync enabled %d times, disabled %d times, %d bounces for %d requests, linger %d ms",
+            m_enableCount, m_disableCount, m_bounceCount, m_requestCount, m_lingerTime);
+}
+
+void HwComposerVSyncSource::request()
+{
+    ++m_requestCount;
+    HwComposerStats::instance()->count(HwComposerStats::VSyncRequest);
+
+    if (m_state == Suspended)
+        return;
+
+    m_lastRequest = m_clock.elapsed();
+
+    if (m_state == Off) {
+        if (m_disabledAt >= 0) {
+            const qint64 offTime = m_lastRequest - m_disabledAt;
+            if (offTime < m_lingerTime) {
+                // We turned vsync off just before it was needed again
+                ++m_bounceCount;
+                HwComposerStats::instance()->count(HwComposerStats::VSyncBounce);
+                m_lingerTime = qMin(2 * m_lingerTime, MAX_LINGER_TIME);
+            } else if (offTime > IDLE_DECAY_TIME) {
+                m_lingerTime = qMax(m_lingerTime / 2, MIN_LINGER_TIME);
+            }
+            HwComposerStats::instance()->setVSyncLingerTime(m_lingerTime);
+        }
+        setEnabled(true);
+    }
+
+    // Restarting the timer on every request is wasteful when animating,
+    // timerEvent() takes care of extending it instead.
+    if (!m_lingerTimeout.isActive())
+        m_lingerTimeout.start(m_lingerTime, this);
+}
+
+void HwComposerVSyncSource::suspend()
+{
+    // Not a decision of the linger time, so neither a disable nor the
+    // start of a bounce when updates come back after the resume
+    if (m_state == On) {
+        m_lingerTimeout.stop();
+        setHardwareVSyncEnabled(false);
+    }
+    m_disabledAt = -1;
+    m_state = Suspended;
+}
+
+void HwComposerVSyncSource::resume()
+{
+    if (m_state == Suspended)
+        m_state = Off;
+}
+
+void HwComposerVSyncSource::setEnabled(bool enabled)
+{
+    if (enabled) {
+        ++m_enableCount;
+        HwComposerStats::instance()->count(HwComposerStats::VSyncEnable);
+        m_state = On;
+    } else {
+        ++m_disableCount;
+        HwComposerStats::instance()->count(HwComposerStats::VSyncDisable);
+        m_state = Off;
+        m_disabledAt = m_clock.elapsed();
+        m_lingerTimeout.stop();
+    }
+    setHardwareVSyncEnabled(enabled);
+}
+
+void HwComposerVSyncSource::timerEvent(QTimerEvent *e)
+{
+    if (e->timerId() != m_lingerTimeout.timerId())
+        return;
+
+    m_lingerTimeout.stop();
+    if (m_state != On)
+        return;
+
+    const qint64 idle = m_clock.elapsed() - m_lastRequest;
+    if (idle < m_lingerTime)
+        m_lingerTimeout.start(int(m_lingerTime - idle), this);
+    else
+        setEnabled(false);
+}
@@ -0,0 +1,99 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef HWCOMPOSER_VSYNC_SOURCE_H
+#define HWCOMPOSER_VSYNC_SOURCE_H
+
+#include <QObject>
+#include <QBasicTimer>
+#include <QElapsedTimer>
+
+// Turns hardware vsync events on when updates are requested, and off again
+// once no update has been requested for a while. Every toggle is a round
+// trip into the HAL, so the time vsync lingers after the last request adapts
+// to how bursty the requests are: if vsync is needed again shortly after it
+// was turned off, it will be kept on for longer the next time.
+class HwComposerVSyncSource : public QObject
+{
+public:
+    HwComposerVSyncSource();
+    virtual ~HwComposerVSyncSource();
+
+    void request();
+
+    // The display is turned off or on, vsync must not be enabled while
+    // suspended. Neither counts as a toggle nor as a bounce.
+    void suspend();
+    void resume();
+
+    bool isEnabled() const { return m_state == On; }
+    int lingerTime() const { return m_lingerTime; }
+
+    int requestCount() const { return m_requestCount; }
+    int enableCount() const { return m_enableCount; }
+    int disableCount() const { return m_disableCount; }
+    int bounceCount() const { return m_bounceCount; }
+
+protected:
+    virtual void setHardwareVSyncEnabled(bool enabled) = 0;
+
+    void timerEvent(QTimerEvent *e) Q_DECL_OVERRIDE;
+
+private:
+    enum State {
+        Off,
+        On,
+        Suspended
+    };
+
+    void setEnabled(bool enabled);
+
+    State m_state;
+    int m_lingerTime;
+    QElapsedTimer m_clock;
+    qint64 m_lastRequest;
+    qint64 m_disabledAt;
+    QBasicTimer m_lingerTimeout;
+
+    int m_requestCount;
+    int m_enableCount;
+    int m_disableCount;
+    int m_bounceCount;
+};
+
+#endif /* HWCOMPOSER_VSYNC_SOURCE_H */
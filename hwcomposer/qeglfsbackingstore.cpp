@@ -41,29 +41,89 @@
 
 #include "qeglfsbackingstore.h"
 #include "qeglfswindow.h"
+#include "qeglfsblitter.h"
 
 #include <QtGui/QOpenGLContext>
-#include <QtGui/QOpenGLPaintDevice>
-#include <QtGui/QOpenGLShaderProgram>
 
 #include <QtGui/QScreen>
 
+#include <string.h>
+
+#ifndef GL_BGRA_EXT
+#define GL_BGRA_EXT 0x80E1
+#endif
+
 QT_BEGIN_NAMESPACE
 
+class QEglFSBackingStore::Job : public QEglFSRenderThread::Job
+{
+public:
+    enum Type { Resize, Frame, Release, ReleasePool };
+
+    Job(QEglFSBackingStore *store, Type type)
+        : store(store), type(type), buffer(-1), window(0) {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        switch (type) {
+        case Resize:
+            store->renderResize(size);
+            break;
+        case Frame:
+            store->renderFrame(store->m_buffers[buffer], window, dirty, damage);
+            break;
+        case Release:
+            store->renderRelease();
+            break;
+        case ReleasePool:
+            store->renderReleasePool();
+            break;
+        }
+        store->jobDone(buffer);
+    }
+
+    QEglFSBackingStore *store;
+    Type type;
+    QSize size;
+    int buffer;
+    QWindow *window;
+    QRegion dirty;
+    QRegion damage;
+};
+
+static void copyRect(QImage *dst, const QImage &src, const QRect &rect)
+{
+    const int bytesPerPixel = src.depth() / 8;
+    const int rowBytes = rect.width() * bytesPerPixel;
+    for (int y = rect.top(); y <= rect.bottom(); ++y)
+        memcpy(dst->scanLine(y) + rect.x() * bytesPerPixel,
+               src.constScanLine(y) + rect.x() * bytesPerPixel, rowBytes);
+}
+
 QEglFSBackingStore::QEglFSBackingStore(QWindow *window)
     : QPlatformBackingStore(window)
-    , m_context(new QOpenGLContext)
-    , m_texture(0)
-    , m_program(0)
+    , m_blitter(static_cast<QEglFSScreen *>(window->screen()->handle())->blitter())
+    , m_context(m_blitter->createContext(window))
+    , m_imageFormat(QImage::Format_RGBA8888_Premultiplied)
+    , m_nextBuffer(0)
+    , m_pendingJobs(0)
 {
-    m_context->setFormat(window->requestedFormat());
-    m_context->setScreen(window->screen());
-    m_context->create();
 }
 
 QEglFSBackingStore::~QEglFSBackingStore()
 {
-    delete m_context;
+    {
+        QMutexLocker lock(&m_mutex);
+        ++m_pendingJobs;
+    }
+    m_blitter->renderThread()->post(new Job(this, Job::Release));
+    waitForIdle();
+
+    QEglFSWindow *platformWindow = static_cast<QEglFSWindow *>(window()->handle());
+    if (platformWindow && platformWindow->backingStore() == this)
+        platformWindow->setBackingStore(NULL);
+
+    m_blitter->destroyContext(m_context);
 }
 
 QPaintDevice *QEglFSBackingStore::paintDevice()
@@ -73,151 +133,205 @@ QPaintDevice *QEglFSBackingStore::paintDevice()
 
 void QEglFSBackingStore::flush(QWindow *window, const QRegion &region, const QPoint &offset)
 {
-    Q_UNUSED(region);
     Q_UNUSED(offset);
 
-    makeCurrent();
-
 #ifdef QEGL_EXTRA_DEBUG
     qWarning("QEglBackingStore::flush %p", window);
 #endif
 
-    if (!m_program) {
-        static const char *textureVertexProgram =
-            "attribute highp vec2 vertexCoordEntry;\n"
-            "attribute highp vec2 textureCoordEntry;\n"
-            "varying highp vec2 textureCoord;\n"
-            "void main() {\n"
-            "   textureCoord = textureCoordEntry;\n"
-            "   gl_Position = vec4(vertexCoordEntry, 0.0, 1.0);\n"
-            "}\n";
-
-        static const char *textureFragmentProgram =
-            "uniform sampler2D texture;\n"
-            "varying highp vec2 textureCoord;\n"
-            "void main() {\n"
-            "   gl_FragColor = texture2D(texture, textureCoord).bgra;\n"
-            "}\n";
-
-        m_program = new QOpenGLShaderProgram;
-
-        m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, textureVertexProgram);
-        m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, textureFragmentProgram);
-        m_program->link();
-
-        m_vertexCoordEntry = m_program->attributeLocation("vertexCoordEntry");
-        m_textureCoordEntry = m_program->attributeLocation("textureCoordEntry");
-    }
-
-    m_program->bind();
+    ensureSurface();
+
+    const QRegion dirty = m_dirty;
+    m_dirty = QRegion();
+    for (int i = 0; i < BufferCount; ++i)
+        m_buffers[i].stale.markDirty(dirty);
+
+    // Bring the buffer up to date with everything painted since it was
+    // last used, the render thread reads it from now on until it is drawn
+    const int index = takeBuffer();
+    Buffer &buffer = m_buffers[index];
+    foreach (const QRect &rect, buffer.stale.dirtyRects())
+        copyRect(&buffer.image, m_image, rect);
+    buffer.stale.clear();
+
+    Job *job = new Job(this, Job::Frame);
+    job->buffer = index;
+    job->window = window;
+    job->dirty = dirty;
+    // Everything is drawn again, but only the flushed region changed
+    job->damage = region;
+    m_blitter->renderThread()->post(job);
+}
 
-    const GLfloat textureCoordinates[] = {
-        0, 1,
-        1, 1,
-        1, 0,
-        0, 0
-    };
+void QEglFSBackingStore::ensureSurface()
+{
+    // needed to prevent QOpenGLContext::makeCurrent() from failing
+    window()->setSurfaceType(QSurface::OpenGLSurface);
+    QEglFSWindow *platformWindow = static_cast<QEglFSWindow *>(window()->handle());
+    platformWindow->setBackingStore(this);
+    platformWindow->ensureNativeWindow();
+}
 
-    QRectF r = window->geometry();
-    QRectF sr = window->screen()->geometry();
+int QEglFSBackingStore::takeBuffer()
+{
+    QMutexLocker lock(&m_mutex);
 
-    GLfloat x1 = (r.left() / sr.width()) * 2 - 1;
-    GLfloat x2 = (r.right() / sr.width()) * 2 - 1;
-    GLfloat y1 = (r.top() / sr.height()) * 2 - 1;
-    GLfloat y2 = (r.bottom() / sr.height()) * 2 - 1;
+    // Frames are drawn in order, so the next buffer is the first to free up
+    while (m_buffers[m_nextBuffer].busy)
+        m_cond.wait(&m_mutex);
 
-    const GLfloat vertexCoordinates[] = {
-        x1, y1,
-        x2, y1,
-        x2, y2,
-        x1, y2
-    };
+    const int index = m_nextBuffer;
+    m_buffers[index].busy = true;
+    m_nextBuffer = (m_nextBuffer + 1) % BufferCount;
+    ++m_pendingJobs;
+    return index;
+}
 
-    glEnableVertexAttribArray(m_vertexCoordEntry);
-    glEnableVertexAttribArray(m_textureCoordEntry);
+void QEglFSBackingStore::waitForIdle()
+{
+    QMutexLocker lock(&m_mutex);
+    while (m_pendingJobs > 0)
+        m_cond.wait(&m_mutex);
+}
 
-    glVertexAttribPointer(m_vertexCoordEntry, 2, GL_FLOAT, GL_FALSE, 0, vertexCoordinates);
-    glVertexAttribPointer(m_textureCoordEntry, 2, GL_FLOAT, GL_FALSE, 0, textureCoordinates);
+void QEglFSBackingStore::jobDone(int buffer)
+{
+    QMutexLocker lock(&m_mutex);
+    if (buffer >= 0)
+        m_buffers[buffer].busy = false;
+    --m_pendingJobs;
+    m_cond.wakeAll();
+}
 
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+void QEglFSBackingStore::beginPaint(const QRegion &rgn)
+{
+    m_dirty += rgn;
+}
 
-    if (!m_dirty.isNull()) {
-        QRect imageRect = m_image.rect();
+void QEglFSBackingStore::endPaint()
+{
+}
 
-        QRegion fixed;
-        foreach (const QRect &rect, m_dirty.rects()) {
-            // intersect with image rect to be sure
-            QRect r = imageRect & rect;
+void QEglFSBackingStore::resize(const QSize &size, const QRegion &staticContents)
+{
+    Q_UNUSED(staticContents);
 
-            // if the rect is wide enough it's cheaper to just
-            // extend it instead of doing an image copy
-            if (r.width() >= imageRect.width() / 2) {
-                r.setX(0);
-                r.setWidth(imageRect.width());
-            }
+    ensureSurface();
 
-            fixed |= r;
+    // The formats depend on what the context supports, wait for the render
+    // thread to pick them. That also waits for the buffers to be drawn.
+    {
+        QMutexLocker lock(&m_mutex);
+        ++m_pendingJobs;
+    }
+    Job *job = new Job(this, Job::Resize);
+    job->size = size;
+    m_blitter->renderThread()->post(job);
+    waitForIdle();
+
+    if (m_image.size() != size || m_image.format() != m_imageFormat) {
+        Images images;
+        if (!m_image.isNull()) {
+            images.image = m_image;
+            for (int i = 0; i < BufferCount; ++i)
+                images.buffers[i] = m_buffers[i].image;
+            // An evicted set is freed as it goes out of scope
+            Images evicted;
+            m_pool.put(qMakePair(m_image.size(), m_image.format()), images, &evicted);
         }
 
-        foreach (const QRect &rect, fixed.rects()) {
-            // if the sub-rect is full-width we can pass the image data directly to
-            // OpenGL instead of copying, since there's no gap between scanlines
-            if (rect.width() == imageRect.width()) {
-                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rect.y(), rect.width(), rect.height(), GL_RGBA, GL_UNSIGNED_BYTE, m_image.constScanLine(rect.y()));
-            } else {
-                glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(), rect.width(), rect.height(), GL_RGBA, GL_UNSIGNED_BYTE,
-                    m_image.copy(rect).constBits());
-            }
+        if (m_pool.take(qMakePair(size, m_imageFormat), &images)) {
+            m_image = images.image;
+            for (int i = 0; i < BufferCount; ++i)
+                m_buffers[i].image = images.buffers[i];
+        } else {
+            m_image = QImage(size, m_imageFormat);
+            for (int i = 0; i < BufferCount; ++i)
+                m_buffers[i].image = QImage(size, m_imageFormat);
         }
+    }
+
+    // Whatever the images held, the window is painted again after a resize
+    m_dirty = QRegion();
+    for (int i = 0; i < BufferCount; ++i)
+        m_buffers[i].stale.resize(size);
+}
+
+void QEglFSBackingStore::renderResize(const QSize &size)
+{
+    m_context->makeCurrent(window());
 
-        m_dirty = QRegion();
+    // Raster content in the layout of the window buffers, or in the one
+    // QPainter is fastest with if the GPU takes it as it is
+    const QSurfaceFormat format = window()->handle()->format();
+    QImage::Format imageFormat = HwComposerContext::imageFormatFor(format);
+    GLenum glFormat = GL_RGBA;
+    GLenum glType = GL_UNSIGNED_BYTE;
+    if (imageFormat == QImage::Format_RGB16) {
+        glFormat = GL_RGB;
+        glType = GL_UNSIGNED_SHORT_5_6_5;
+    } else if (m_context->hasExtension(QByteArrayLiteral("GL_EXT_texture_format_BGRA8888"))) {
+        imageFormat = format.hasAlpha() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+        glFormat = GL_BGRA_EXT;
     }
 
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    m_imageFormat = imageFormat;
+    m_uploader.resize(size, glFormat, glType, glType == GL_UNSIGNED_SHORT_5_6_5 ? 2 : 4);
+
+    m_context->doneCurrent();
+}
+
+void QEglFSBackingStore::renderFrame(const Buffer &buffer, QWindow *window,
+                                     const QRegion &dirty, const QRegion &damage)
+{
+    m_uploader.markDirty(dirty);
+
+    // The window lost its surface since the frame was posted
+    if (!window->handle() || !m_context->makeCurrent(window))
+        return;
 
-    m_program->release();
+    // Binds the texture it brings up to date
+    m_uploader.upload(buffer.image);
+
+    m_blitter->blit();
     glBindTexture(GL_TEXTURE_2D, 0);
-    glDisableVertexAttribArray(m_vertexCoordEntry);
-    glDisableVertexAttribArray(m_textureCoordEntry);
 
+    static_cast<QEglFSWindow *>(window->handle())->setSwapDamage(damage);
     m_context->swapBuffers(window);
 
     m_context->doneCurrent();
 }
 
-void QEglFSBackingStore::makeCurrent()
+void QEglFSBackingStore::renderRelease()
 {
-    // needed to prevent QOpenGLContext::makeCurrent() from failing
-    window()->setSurfaceType(QSurface::OpenGLSurface);
-    (static_cast<QEglFSWindow *>(window()->handle()))->create();
-    m_context->makeCurrent(window());
-}
+    // The textures are in the share group of the screen and would outlive
+    // the context otherwise
+    if (!window()->handle() || !m_context->makeCurrent(window()))
+        return;
 
-void QEglFSBackingStore::beginPaint(const QRegion &rgn)
-{
-    m_dirty = m_dirty | rgn;
+    m_uploader.destroy();
+    m_context->doneCurrent();
 }
 
-void QEglFSBackingStore::endPaint()
+void QEglFSBackingStore::releasePools()
 {
+    // The images are freed with the list
+    m_pool.takeAll();
+
+    {
+        QMutexLocker lock(&m_mutex);
+        ++m_pendingJobs;
+    }
+    m_blitter->renderThread()->post(new Job(this, Job::ReleasePool));
 }
 
-void QEglFSBackingStore::resize(const QSize &size, const QRegion &staticContents)
+void QEglFSBackingStore::renderReleasePool()
 {
-    Q_UNUSED(staticContents);
+    if (!window()->handle() || !m_context->makeCurrent(window()))
+        return;
 
-    m_image = QImage(size, QImage::Format_RGB32);
-    makeCurrent();
-    if (m_texture)
-        glDeleteTextures(1, &m_texture);
-    glGenTextures(1, &m_texture);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.width(), size.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    m_uploader.releasePool();
+    m_context->doneCurrent();
 }
 
 QT_END_NAMESPACE
@@ -46,13 +46,22 @@
 
 #include <QImage>
 #include <QRegion>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "qeglfstextureuploader.h"
+#include "qeglfstilemap.h"
+#include "qeglfsbufferpool.h"
 
 QT_BEGIN_NAMESPACE
 
 class QOpenGLContext;
-class QOpenGLPaintDevice;
-class QOpenGLShaderProgram;
+class QEglFSBlitter;
 
+// Flushes are drawn and swapped on the render thread of the screen. The
+// flushed part of the painted image is copied to one of a few buffers that
+// the render thread uploads from, so painting can go on while it works.
+// flush() only blocks when every buffer is still waiting to be drawn.
 class QEglFSBackingStore : public QPlatformBackingStore
 {
 public:
@@ -67,16 +76,62 @@ public:
     void flush(QWindow *window, const QRegion &region, const QPoint &offset);
     void resize(const QSize &size, const QRegion &staticContents);
 
+    // Frees what was kept for sizes the window may come back to, called
+    // once the window is hidden
+    void releasePools();
+
 private:
-    void makeCurrent();
+    enum {
+        BufferCount = 2,
+        // The images of the size used before, like the other orientation
+        PoolCapacity = 1
+    };
+
+    struct Images {
+        QImage image;
+        QImage buffers[BufferCount];
+    };
+
+    struct Buffer {
+        Buffer() : busy(false) {}
+
+        QImage image;
+        // What the image misses compared to the painted one
+        QEglFSTileMap stale;
+        // Posted to the render thread and not drawn yet
+        bool busy;
+    };
+
+    class Job;
 
+    void ensureSurface();
+    int takeBuffer();
+    void waitForIdle();
+
+    // Render thread
+    void renderResize(const QSize &size);
+    void renderFrame(const Buffer &buffer, QWindow *window, const QRegion &dirty, const QRegion &damage);
+    void renderRelease();
+    void renderReleasePool();
+    void jobDone(int buffer);
+
+    QEglFSBlitter *m_blitter;
     QOpenGLContext *m_context;
+
+    // Painted on the GUI thread
     QImage m_image;
-    uint m_texture;
+    QImage::Format m_imageFormat;
     QRegion m_dirty;
-    QOpenGLShaderProgram *m_program;
-    int m_vertexCoordEntry;
-    int m_textureCoordEntry;
+    Buffer m_buffers[BufferCount];
+    int m_nextBuffer;
+    QEglFSBufferPool<QPair<QSize, QImage::Format>, Images, PoolCapacity> m_pool;
+
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    int m_pendingJobs;
+
+    // Used on the render thread only
+    QEglFSTextureUploader m_uploader;
 };
 
 QT_END_NAMESPACE
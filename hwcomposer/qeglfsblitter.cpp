@@ -0,0 +1,283 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qeglfsblitter.h"
+
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLFunctions>
+#include <QtGui/QOpenGLShaderProgram>
+#include <QtGui/QWindow>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+
+#include <string.h>
+
+#ifndef GL_PROGRAM_BINARY_LENGTH_OES
+#define GL_PROGRAM_BINARY_LENGTH_OES 0x8741
+#endif
+
+QT_BEGIN_NAMESPACE
+
+typedef void (QOPENGLF_APIENTRYP GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei *length,
+                                                   GLenum *binaryFormat, void *binary);
+typedef void (QOPENGLF_APIENTRYP ProgramBinary)(GLuint program, GLenum binaryFormat,
+                                                const void *binary, GLint length);
+
+class QEglFSBlitter::ReleaseJob : public QEglFSRenderThread::Job
+{
+public:
+    ReleaseJob(QEglFSBlitter *blitter, QOpenGLContext *context, bool last)
+        : m_blitter(blitter), m_context(context), m_last(last) {}
+
+    void run() Q_DECL_OVERRIDE { m_blitter->releaseContext(m_context, m_last); }
+
+private:
+    QEglFSBlitter *m_blitter;
+    QOpenGLContext *m_context;
+    bool m_last;
+};
+
+static const char *textureVertexProgram =
+    "attribute highp vec2 vertexCoordEntry;\n"
+    "attribute highp vec2 textureCoordEntry;\n"
+    "varying highp vec2 textureCoord;\n"
+    "void main() {\n"
+    "   textureCoord = textureCoordEntry;\n"
+    "   gl_Position = vec4(vertexCoordEntry, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *textureFragmentProgram =
+    "uniform sampler2D texture;\n"
+    "varying highp vec2 textureCoord;\n"
+    "void main() {\n"
+    "   gl_FragColor = texture2D(texture, textureCoord);\n"
+    "}\n";
+
+QEglFSBlitter::QEglFSBlitter()
+    : m_program(0)
+    , m_vertexCoordEntry(-1)
+    , m_textureCoordEntry(-1)
+{
+}
+
+QEglFSBlitter::~QEglFSBlitter()
+{
+    m_renderThread.stop();
+    delete m_program;
+}
+
+QOpenGLContext *QEglFSBlitter::createContext(QWindow *window)
+{
+    QOpenGLContext *context = new QOpenGLContext;
+    context->setFormat(window->requestedFormat());
+    context->setScreen(window->screen());
+    if (!m_contexts.isEmpty())
+        context->setShareContext(m_contexts.first());
+    context->create();
+    context->moveToThread(&m_renderThread);
+
+    m_contexts.append(context);
+    return context;
+}
+
+void QEglFSBlitter::destroyContext(QOpenGLContext *context)
+{
+    m_contexts.removeOne(context);
+    m_renderThread.post(new ReleaseJob(this, context, m_contexts.isEmpty()));
+}
+
+void QEglFSBlitter::releaseContext(QOpenGLContext *context, bool last)
+{
+    // The share group goes away with its last context. A context created
+    // since then starts a new group, its jobs only run after this one.
+    if (last) {
+        delete m_program;
+        m_program = 0;
+    }
+
+    if (QOpenGLContext::currentContext() == context)
+        context->doneCurrent();
+    delete context;
+}
+
+void QEglFSBlitter::blit()
+{
+    if (!m_program && !initProgram())
+        return;
+
+    m_program->bind();
+
+    static const GLfloat textureCoordinates[] = {
+        0, 1,
+        1, 1,
+        1, 0,
+        0, 0
+    };
+
+    static const GLfloat vertexCoordinates[] = {
+        -1, -1,
+         1, -1,
+         1,  1,
+        -1,  1
+    };
+
+    glEnableVertexAttribArray(m_vertexCoordEntry);
+    glEnableVertexAttribArray(m_textureCoordEntry);
+
+    glVertexAttribPointer(m_vertexCoordEntry, 2, GL_FLOAT, GL_FALSE, 0, vertexCoordinates);
+    glVertexAttribPointer(m_textureCoordEntry, 2, GL_FLOAT, GL_FALSE, 0, textureCoordinates);
+
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    glDisableVertexAttribArray(m_vertexCoordEntry);
+    glDisableVertexAttribArray(m_textureCoordEntry);
+
+    m_program->release();
+}
+
+bool QEglFSBlitter::initProgram()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+
+    // Binaries only fit the driver that made them
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(reinterpret_cast<const char *>(glGetString(GL_VENDOR)));
+    hash.addData(reinterpret_cast<const char *>(glGetString(GL_RENDERER)));
+    hash.addData(reinterpret_cast<const char *>(glGetString(GL_VERSION)));
+    hash.addData(textureVertexProgram);
+    hash.addData(textureFragmentProgram);
+    const QByteArray key = hash.result().toHex();
+
+    const bool useCache = context->hasExtension(QByteArrayLiteral("GL_OES_get_program_binary"))
+        && !qgetenv("QPA_HWC_WORKAROUNDS").split(',').contains("no-program-cache");
+
+    m_program = new QOpenGLShaderProgram;
+
+    if (!useCache || !loadProgramBinary(key)) {
+        m_program->removeAllShaders();
+        m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, textureVertexProgram);
+        m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, textureFragmentProgram);
+        if (!m_program->link()) {
+            qWarning("QPA-HWC: could not link the backing store program: %s", qPrintable(m_program->log()));
+            delete m_program;
+            m_program = 0;
+            return false;
+        }
+
+        if (useCache)
+            saveProgramBinary(key);
+    }
+
+    m_vertexCoordEntry = m_program->attributeLocation("vertexCoordEntry");
+    m_textureCoordEntry = m_program->attributeLocation("textureCoordEntry");
+    return true;
+}
+
+static QString programCachePath(const QByteArray &key)
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QLatin1String("/qpa-hwc/") + QString::fromLatin1(key);
+}
+
+bool QEglFSBlitter::loadProgramBinary(const QByteArray &key)
+{
+    QFile file(programCachePath(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray data = file.readAll();
+    if (data.size() <= int(sizeof(GLenum)))
+        return false;
+
+    ProgramBinary programBinary = reinterpret_cast<ProgramBinary>(
+        QOpenGLContext::currentContext()->getProcAddress("glProgramBinaryOES"));
+    if (!programBinary)
+        return false;
+
+    // Format of the binary first, the binary after it
+    GLenum format;
+    memcpy(&format, data.constData(), sizeof(format));
+
+    m_program->create();
+    programBinary(m_program->programId(), format, data.constData() + sizeof(format),
+                  data.size() - sizeof(format));
+
+    // Without shaders, link() only checks the link status of the binary
+    if (!m_program->link()) {
+        // From an older driver after all
+        file.remove();
+        return false;
+    }
+    return true;
+}
+
+void QEglFSBlitter::saveProgramBinary(const QByteArray &key)
+{
+    GetProgramBinary getProgramBinary = reinterpret_cast<GetProgramBinary>(
+        QOpenGLContext::currentContext()->getProcAddress("glGetProgramBinaryOES"));
+    if (!getProgramBinary)
+        return;
+
+    GLint length = 0;
+    QOpenGLContext::currentContext()->functions()->glGetProgramiv(m_program->programId(),
+                                                                  GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0)
+        return;
+
+    GLenum format = 0;
+    QByteArray data(sizeof(format) + length, Qt::Uninitialized);
+    getProgramBinary(m_program->programId(), length, &length, &format, data.data() + sizeof(format));
+    memcpy(data.data(), &format, sizeof(format));
+    data.resize(sizeof(format) + length);
+
+    const QString path = programCachePath(key);
+    QDir().mkpath(QFileInfo(path).path());
+
+    // Another process starting at the same time must never load half a
+    // binary, the file is replaced only once complete
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+        qWarning("QPA-HWC: could not write program cache %s", qPrintable(path));
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,93 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QEGLFSBLITTER_H
+#define QEGLFSBLITTER_H
+
+#include <QtGui/qopengl.h>
+#include <QtCore/QList>
+#include <QtCore/QByteArray>
+
+#include "qeglfsrenderthread.h"
+
+QT_BEGIN_NAMESPACE
+
+class QOpenGLContext;
+class QOpenGLShaderProgram;
+class QWindow;
+
+// GL resources shared by the backing stores of a screen. Their contexts
+// are in one share group, so the program that draws backing store textures
+// is only built once, and its linked binary is kept on disk so that later
+// runs do not have to compile it at all. The contexts are used on the
+// render thread only, so blit() is only called from there.
+class QEglFSBlitter
+{
+public:
+    QEglFSBlitter();
+    ~QEglFSBlitter();
+
+    // The context is moved to the render thread, and deleted there once
+    // the jobs posted before destroyContext() have run
+    QOpenGLContext *createContext(QWindow *window);
+    void destroyContext(QOpenGLContext *context);
+
+    QEglFSRenderThread *renderThread() { return &m_renderThread; }
+
+    // Draws the bound texture over the whole surface of the current context
+    void blit();
+
+private:
+    bool initProgram();
+    bool loadProgramBinary(const QByteArray &key);
+    void saveProgramBinary(const QByteArray &key);
+    void releaseContext(QOpenGLContext *context, bool last);
+
+    class ReleaseJob;
+
+    QEglFSRenderThread m_renderThread;
+    QList<QOpenGLContext *> m_contexts;
+    QOpenGLShaderProgram *m_program;
+    int m_vertexCoordEntry;
+    int m_textureCoordEntry;
+};
+
+QT_END_NAMESPACE
+
+#endif // QEGLFSBLITTER_H
@@ -0,0 +1,95 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QEGLFSBUFFERPOOL_H
+#define QEGLFSBUFFERPOOL_H
+
+#include <QtCore/QList>
+#include <QtCore/QPair>
+
+QT_BEGIN_NAMESPACE
+
+// Buffers that are not in use right now, kept by what they were allocated
+// for, such as size and format, so that going back to a recent size (say,
+// after rotating the screen twice) does not allocate again. Holds at most
+// Capacity buffers, the least recently used ones drop out first.
+template <typename Key, typename T, int Capacity>
+class QEglFSBufferPool
+{
+public:
+    // Removes a buffer for key from the pool into value
+    bool take(const Key &key, T *value)
+    {
+        for (int i = 0; i < m_entries.size(); ++i) {
+            if (m_entries.at(i).first == key) {
+                *value = m_entries.takeAt(i).second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Returns true if that made the least recently used buffer drop out,
+    // which the caller then frees
+    bool put(const Key &key, const T &value, T *evicted)
+    {
+        m_entries.prepend(qMakePair(key, value));
+        if (m_entries.size() <= Capacity)
+            return false;
+
+        *evicted = m_entries.takeLast().second;
+        return true;
+    }
+
+    // Empties the pool into values, for the caller to free
+    QList<T> takeAll()
+    {
+        QList<T> values;
+        for (int i = 0; i < m_entries.size(); ++i)
+            values.append(m_entries.at(i).second);
+        m_entries.clear();
+        return values;
+    }
+
+private:
+    QList<QPair<Key, T> > m_entries;
+};
+
+QT_END_NAMESPACE
+
+#endif // QEGLFSBUFFERPOOL_H
@@ -64,10 +64,10 @@ QEglFSContext::QEglFSContext(
 #endif
                             )
     : QEGLPlatformContext(
-                          hwc->surfaceFormatFor(format)
+                          format
                         , share
                         , display
-                        , &(m_config = QEglFSIntegration::chooseConfig(display, hwc->surfaceFormatFor(format)))
+                        , &(m_config = QEglFSIntegration::chooseConfig(display, format))
 #if QT_VERSION < QT_VERSION_CHECK(5, 3, 0)
                         , eglApi
 #endif
@@ -96,10 +96,14 @@ bool QEglFSContext::makeCurrent(QPlatformSurface *surface)
 
 EGLSurface QEglFSContext::eglSurfaceForPlatformSurface(QPlatformSurface *surface)
 {
-    if (surface->surface()->surfaceClass() == QSurface::Window)
-        return static_cast<QEglFSWindow *>(surface)->surface();
-    else
+    if (surface->surface()->surfaceClass() == QSurface::Window) {
+        // Drawn to before it was shown
+        QEglFSWindow *window = static_cast<QEglFSWindow *>(surface);
+        window->ensureNativeWindow();
+        return window->surface();
+    } else {
         return static_cast<QEGLPbuffer *>(surface)->pbuffer();
+    }
 }
 
 void QEglFSContext::swapBuffers(QPlatformSurface *surface)
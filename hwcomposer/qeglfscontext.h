@@ -60,6 +60,7 @@ QT_BEGIN_NAMESPACE
 class QEglFSContext : public QEGLPlatformContext
 {
 public:
+    // format is already one from HwComposerContext::surfaceFormatFor()
     QEglFSContext(HwComposerContext *hwc,
             const QSurfaceFormat &format, QPlatformOpenGLContext *share, EGLDisplay display
 #if QT_VERSION < QT_VERSION_CHECK(5, 3, 0)
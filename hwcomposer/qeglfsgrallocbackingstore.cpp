@@ -0,0 +1,252 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qeglfsgrallocbackingstore.h"
+#include "qeglfswindow.h"
+#include "hwcomposer_context.h"
+
+#include <QtGui/QPainter>
+
+#include <sync/sync.h>
+#include <string.h>
+#include <unistd.h>
+
+QT_BEGIN_NAMESPACE
+
+static const int BufferUsage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN
+                             | GRALLOC_USAGE_HW_COMPOSER;
+
+QEglFSGrallocBackingStore::QEglFSGrallocBackingStore(HwComposerContext *hwc, QWindow *window)
+    : QPlatformBackingStore(window)
+    , m_hwc(hwc)
+    , m_gralloc(NULL)
+    , m_native(NULL)
+    , m_buffer(NULL)
+{
+    if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, (const hw_module_t **) &m_gralloc) != 0) {
+        qWarning("QPA-HWC: could not open the gralloc module, raster windows stay empty");
+        m_gralloc = NULL;
+    }
+}
+
+QEglFSGrallocBackingStore::~QEglFSGrallocBackingStore()
+{
+    if (m_buffer) {
+        unlock(m_buffer);
+        m_native->cancelBuffer(m_native, m_buffer, -1);
+    }
+}
+
+QPaintDevice *QEglFSGrallocBackingStore::paintDevice()
+{
+    return &m_image;
+}
+
+QImage::Format QEglFSGrallocBackingStore::imageFormat() const
+{
+    return HwComposerContext::imageFormatFor(window()->handle()->format());
+}
+
+void *QEglFSGrallocBackingStore::lock(ANativeWindowBuffer *buffer, int usage)
+{
+    void *bits = NULL;
+    if (m_gralloc->lock(m_gralloc, buffer->handle, usage,
+                        0, 0, buffer->width, buffer->height, &bits) != 0)
+        return NULL;
+    return bits;
+}
+
+void QEglFSGrallocBackingStore::unlock(ANativeWindowBuffer *buffer)
+{
+    m_gralloc->unlock(m_gralloc, buffer->handle);
+}
+
+bool QEglFSGrallocBackingStore::dequeueBuffer()
+{
+    QEglFSWindow *platformWindow = static_cast<QEglFSWindow *>(window()->handle());
+    platformWindow->ensureNativeWindow();
+    ANativeWindow *native = (ANativeWindow *) platformWindow->nativeWindow();
+    if (!native || !m_gralloc)
+        return false;
+
+    if (native != m_native) {
+        // A new window after a resize, none of its buffers have content
+        m_native = native;
+        m_history.clear();
+        native_window_api_connect(native, NATIVE_WINDOW_API_CPU);
+        native_window_set_usage(native, BufferUsage);
+    }
+
+    ANativeWindowBuffer *buffer = NULL;
+    int fenceFd = -1;
+    if (native->dequeueBuffer(native, &buffer, &fenceFd) != 0)
+        return false;
+
+    // Buffers of a resized window start out without content, the ones in
+    // the history may be gone already
+    const QSize bufferSize(buffer->width, buffer->height);
+    if (bufferSize != m_bufferSize) {
+        m_bufferSize = bufferSize;
+        m_history.clear();
+    }
+
+    // The hwcomposer may still be reading from it
+    if (fenceFd != -1) {
+        sync_wait(fenceFd, -1);
+        close(fenceFd);
+    }
+
+    void *bits = lock(buffer, BufferUsage);
+    if (!bits) {
+        qWarning("QPA-HWC: could not map window buffer %p", buffer);
+        native->cancelBuffer(native, buffer, -1);
+        return false;
+    }
+
+    m_buffer = buffer;
+    const QImage::Format format = imageFormat();
+    m_image = QImage(static_cast<uchar *>(bits), buffer->width, buffer->height,
+                     buffer->stride * (format == QImage::Format_RGB16 ? 2 : 4), format);
+    return true;
+}
+
+void QEglFSGrallocBackingStore::copyBack(const QRegion &painted)
+{
+    if (m_history.isEmpty())
+        return;
+
+    ANativeWindowBuffer *front = m_history.last().buffer;
+    if (front == m_buffer)
+        return;
+
+    // Buffers rotate, so this one misses what the frames queued since it
+    // was last shown changed. Those parts come from the latest buffer.
+    QRegion stale;
+    int i = m_history.size() - 1;
+    while (i >= 0 && m_history.at(i).buffer != m_buffer)
+        stale |= m_history.at(i--).damage;
+    if (i < 0)
+        stale = m_image.rect();
+    stale -= painted;
+    if (stale.isEmpty())
+        return;
+
+    const uchar *src = static_cast<const uchar *>(lock(front, GRALLOC_USAGE_SW_READ_OFTEN));
+    if (!src)
+        return;
+
+    const int bpp = m_image.depth() / 8;
+    const int srcStride = front->stride * bpp;
+    const int dstStride = m_image.bytesPerLine();
+    uchar *dst = m_image.bits();
+    foreach (const QRect &rect, (stale & m_image.rect()).rects()) {
+        for (int y = rect.top(); y <= rect.bottom(); ++y)
+            memcpy(dst + y * dstStride + rect.x() * bpp, src + y * srcStride + rect.x() * bpp, rect.width() * bpp);
+    }
+
+    unlock(front);
+}
+
+void QEglFSGrallocBackingStore::beginPaint(const QRegion &region)
+{
+    if (!m_buffer) {
+        if (!dequeueBuffer()) {
+            // Paint somewhere so that nothing crashes, it is not shown
+            if (m_image.size() != window()->size())
+                m_image = QImage(window()->size(), imageFormat());
+            return;
+        }
+        copyBack(region);
+    }
+
+    m_dirty |= region;
+
+    if (m_image.hasAlphaChannel()) {
+        QPainter painter(&m_image);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        foreach (const QRect &rect, region.rects())
+            painter.fillRect(rect, Qt::transparent);
+    }
+}
+
+void QEglFSGrallocBackingStore::endPaint()
+{
+}
+
+void QEglFSGrallocBackingStore::flush(QWindow *window, const QRegion &region, const QPoint &offset)
+{
+    Q_UNUSED(region);
+    Q_UNUSED(offset);
+
+    if (!m_buffer)
+        return;
+
+    // The image points into the buffer, which is only mapped while locked
+    unlock(m_buffer);
+    m_image = QImage();
+
+    Frame frame;
+    frame.buffer = m_buffer;
+    frame.damage = m_dirty;
+    m_history.append(frame);
+    if (m_history.size() > MaxHistory)
+        m_history.removeFirst();
+
+    m_hwc->presentRasterBuffer(static_cast<QEglFSWindow *>(window->handle()), m_buffer, m_dirty);
+
+    m_buffer = NULL;
+    m_dirty = QRegion();
+}
+
+void QEglFSGrallocBackingStore::resize(const QSize &size, const QRegion &staticContents)
+{
+    // Buffers have the size of the native window, which follows the
+    // geometry of the window. One dequeued before a resize goes back.
+    Q_UNUSED(staticContents);
+
+    if (m_buffer && size != m_bufferSize) {
+        unlock(m_buffer);
+        m_native->cancelBuffer(m_native, m_buffer, -1);
+        m_buffer = NULL;
+        m_image = QImage();
+        m_dirty = QRegion();
+    }
+}
+
+QT_END_NAMESPACE
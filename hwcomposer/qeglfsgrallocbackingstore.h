@@ -0,0 +1,102 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QEGLFSGRALLOCBACKINGSTORE_H
+#define QEGLFSGRALLOCBACKINGSTORE_H
+
+#include <qpa/qplatformbackingstore.h>
+
+#include <QImage>
+#include <QRegion>
+#include <QList>
+
+#include <system/window.h>
+#include <hardware/gralloc.h>
+
+QT_BEGIN_NAMESPACE
+
+class HwComposerContext;
+
+// Backing store of raster windows that paints straight into the gralloc
+// buffers of the native window. Filled buffers are queued to the
+// hwcomposer as they are, without an upload or a GL composition.
+class QEglFSGrallocBackingStore : public QPlatformBackingStore
+{
+public:
+    QEglFSGrallocBackingStore(HwComposerContext *hwc, QWindow *window);
+    ~QEglFSGrallocBackingStore();
+
+    QPaintDevice *paintDevice();
+
+    void beginPaint(const QRegion &);
+    void endPaint();
+
+    void flush(QWindow *window, const QRegion &region, const QPoint &offset);
+    void resize(const QSize &size, const QRegion &staticContents);
+
+private:
+    enum { MaxHistory = 8 };
+
+    struct Frame {
+        ANativeWindowBuffer *buffer;
+        QRegion damage;
+    };
+
+    bool dequeueBuffer();
+    void copyBack(const QRegion &painted);
+    void *lock(ANativeWindowBuffer *buffer, int usage);
+    void unlock(ANativeWindowBuffer *buffer);
+    QImage::Format imageFormat() const;
+
+    HwComposerContext *m_hwc;
+    const gralloc_module_t *m_gralloc;
+    ANativeWindow *m_native;
+    // Dequeued and locked for painting between beginPaint() and flush()
+    ANativeWindowBuffer *m_buffer;
+    // Size of the buffers of the native window, they change with a resize
+    QSize m_bufferSize;
+    QImage m_image;
+    QRegion m_dirty;
+    // Buffers queued so far and what they changed, oldest first
+    QList<Frame> m_history;
+};
+
+QT_END_NAMESPACE
+
+#endif // QEGLFSGRALLOCBACKINGSTORE_H
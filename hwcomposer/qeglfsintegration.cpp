@@ -43,6 +43,9 @@
 
 #include "qeglfswindow.h"
 #include "qeglfsbackingstore.h"
+#ifdef HWC_PLUGIN_HAVE_HWCOMPOSER1_API
+#include "qeglfsgrallocbackingstore.h"
+#endif
 
 #include <QtGui/private/qguiapplication_p.h>
 
@@ -72,6 +75,10 @@
 #include <qpa/qplatforminputcontextfactory_p.h>
 
 #include "qeglfscontext.h"
+#include "hwcomposer_startup.h"
+
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
 
 #include <EGL/egl.h>
 
@@ -95,48 +102,88 @@ QEglFSIntegration::QEglFSIntegration()
     QGuiApplicationPrivate::instance()->setEventDispatcher(mEventDispatcher);
 #endif
 
-    mHwc = new HwComposerContext();
+    HwComposerStartup startup;
+    startup.run();
+
+    mHwc = new HwComposerContext(startup.backend(), startup.screenInfo());
+    mDisplay = startup.eglDisplay();
 
-    EGLint major, minor;
+    // Have the configs of plain windows and contexts, opaque or not, ready
+    QSurfaceFormat format;
+    chooseConfig(mDisplay, mHwc->surfaceFormatFor(format));
+    format.setAlphaBufferSize(8);
+    chooseConfig(mDisplay, mHwc->surfaceFormatFor(format));
 
     if (!eglBindAPI(EGL_OPENGL_ES_API)) {
         qWarning("Could not bind GL_ES API\n");
         qFatal("EGL error");
     }
 
-    mDisplay = eglGetDisplay(mHwc->platformDisplay());
-    if (mDisplay == EGL_NO_DISPLAY) {
-        qWarning("Could not open egl display\n");
-        qFatal("EGL error");
-    }
+    mScreen = new QEglFSScreen(mHwc, mDisplay);
+    addScreen(mScreen);
 
-    if (!eglInitialize(mDisplay, &major, &minor)) {
-        qWarning("Could not initialize egl display\n");
-        qFatal("EGL error");
-    }
+    // Displays that are already connected are announced once the event
+    // loop runs
+    mHwc->setDisplayListener(this);
 
-    mScreen = new QEglFSScreen(mHwc, mDisplay);
+    mInputContext = QPlatformInputContextFactory::create();
+}
+
+QEglFSIntegration::~QEglFSIntegration()
+{
+    mHwc->setDisplayListener(NULL);
+    foreach (QPlatformScreen *screen, mExternalScreens)
+        removeScreen(screen);
+    mExternalScreens.clear();
+
+    removeScreen(mScreen);
+
+    clearConfigCache(mDisplay);
+    eglTerminate(mDisplay);
+    delete mHwc;
+}
+
+void QEglFSIntegration::addScreen(QPlatformScreen *screen)
+{
+    // The first screen added stays the primary one
 #if QT_VERSION < QT_VERSION_CHECK(5, 13, 0)
-    screenAdded(mScreen);
+    screenAdded(screen);
 #else
-    QWindowSystemInterface::handleScreenAdded(mScreen);
+    QWindowSystemInterface::handleScreenAdded(screen);
 #endif
-
-    mInputContext = QPlatformInputContextFactory::create();
 }
 
-QEglFSIntegration::~QEglFSIntegration()
+void QEglFSIntegration::removeScreen(QPlatformScreen *screen)
 {
+    // Windows on the screen move to the primary one
 #if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
-    QWindowSystemInterface::handleScreenRemoved(mScreen);
+    QWindowSystemInterface::handleScreenRemoved(screen);
 #elif QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
-    destroyScreen(mScreen);
+    destroyScreen(screen);
 #else
-    delete mScreen;
+    delete screen;
 #endif
+}
 
-    eglTerminate(mDisplay);
-    delete mHwc;
+void QEglFSIntegration::displayConnected(int display)
+{
+    if (mExternalScreens.contains(display))
+        return;
+
+    qDebug("QPA-HWC: display %d connected", display);
+    QEglFSScreen *screen = new QEglFSScreen(mHwc, mDisplay, display);
+    mExternalScreens.insert(display, screen);
+    addScreen(screen);
+}
+
+void QEglFSIntegration::displayDisconnected(int display)
+{
+    QPlatformScreen *screen = mExternalScreens.take(display);
+    if (!screen)
+        return;
+
+    qDebug("QPA-HWC: display %d disconnected", display);
+    removeScreen(screen);
 }
 
 bool QEglFSIntegration::hasCapability(QPlatformIntegration::Capability cap) const
@@ -163,6 +210,11 @@ QPlatformWindow *QEglFSIntegration::createPlatformWindow(QWindow *window) const
 
 QPlatformBackingStore *QEglFSIntegration::createPlatformBackingStore(QWindow *window) const
 {
+#ifdef HWC_PLUGIN_HAVE_HWCOMPOSER1_API
+    QEglFSWindow *platformWindow = static_cast<QEglFSWindow *>(window->handle());
+    if (platformWindow && platformWindow->isRaster())
+        return new QEglFSGrallocBackingStore(mHwc, window);
+#endif
     return new QEglFSBackingStore(window);
 }
 
@@ -212,10 +264,27 @@ void *QEglFSIntegration::nativeResourceForIntegration(const QByteArray &resource
         return static_cast<QEglFSScreen *>(mScreen)->display();
     } else if (lowerCaseResource == "displayoff") {
         // Called from lipstick to turn off the display (src/homeapplication.cpp)
-        mHwc->sleepDisplay(true);
+        mHwc->sleepDisplay(0, true);
     } else if (lowerCaseResource == "displayon") {
         // Called from lipstick to turn on the display (src/homeapplication.cpp)
-        mHwc->sleepDisplay(false);
+        mHwc->sleepDisplay(0, false);
+    }
+
+    return NULL;
+}
+
+void *QEglFSIntegration::nativeResourceForScreen(const QByteArray &resource, QScreen *screen)
+{
+    QByteArray lowerCaseResource = resource.toLower();
+    QEglFSScreen *eglfsScreen = static_cast<QEglFSScreen *>(screen ? screen->handle() : mScreen);
+
+    if (lowerCaseResource == "egldisplay") {
+        return eglfsScreen->display();
+    } else if (lowerCaseResource == "displayoff") {
+        // Like the integration resource, for the display of one screen
+        mHwc->sleepDisplay(eglfsScreen->hwcDisplay(), true);
+    } else if (lowerCaseResource == "displayon") {
+        mHwc->sleepDisplay(eglfsScreen->hwcDisplay(), false);
     }
 
     return NULL;
@@ -235,6 +304,44 @@ void *QEglFSIntegration::nativeResourceForWindow(const QByteArray &resource, QWi
     return 0;
 }
 
+// Direct scanout for compositors, resolved through
+// nativeResourceFunctionForIntegration("scanoutbuffer"/"endscanout"):
+//
+//   bool scanoutBuffer(void *nativeBuffer, int *displayedFenceFd)
+//   int endScanout()
+//
+// scanoutBuffer() shows an ANativeWindowBuffer fullscreen in place of the
+// window on the primary display. It returns false if the display would need
+// GL composition for it, otherwise displayedFenceFd gets a fence (or -1)
+// that signals once the buffer is on screen, the previous buffer is free
+// from then on. endScanout() shows the window again and returns a fence (or
+// -1) that signals once the last buffer is off screen. Fences belong to the
+// caller.
+static bool hwcScanoutBuffer(void *nativeBuffer, int *displayedFenceFd)
+{
+    QEglFSIntegration *integration = static_cast<QEglFSIntegration *>(QGuiApplicationPrivate::platformIntegration());
+    return integration->hwc()->scanoutBuffer(nativeBuffer, displayedFenceFd);
+}
+
+static int hwcEndScanout()
+{
+    QEglFSIntegration *integration = static_cast<QEglFSIntegration *>(QGuiApplicationPrivate::platformIntegration());
+    return integration->hwc()->endScanout();
+}
+
+QPlatformNativeInterface::NativeResourceForIntegrationFunction
+QEglFSIntegration::nativeResourceFunctionForIntegration(const QByteArray &resource)
+{
+    QByteArray lowerCaseResource = resource.toLower();
+
+    if (lowerCaseResource == "scanoutbuffer")
+        return reinterpret_cast<NativeResourceForIntegrationFunction>(hwcScanoutBuffer);
+    else if (lowerCaseResource == "endscanout")
+        return reinterpret_cast<NativeResourceForIntegrationFunction>(hwcEndScanout);
+
+    return 0;
+}
+
 void *QEglFSIntegration::nativeResourceForContext(const QByteArray &resource, QOpenGLContext *context)
 {
     QByteArray lowerCaseResource = resource.toLower();
@@ -250,11 +357,87 @@ void *QEglFSIntegration::nativeResourceForContext(const QByteArray &resource, QO
     return 0;
 }
 
+// Prefers configs whose native visual is the HAL format of the window
+// buffers, so that the driver renders without converting
+class HwcConfigChooser : public QEglConfigChooser
+{
+public:
+    HwcConfigChooser(EGLDisplay display, int halFormat)
+        : QEglConfigChooser(display)
+        , m_halFormat(halFormat)
+    {
+    }
+
+protected:
+    bool filterConfig(EGLConfig config) const Q_DECL_OVERRIDE
+    {
+        EGLint visual = 0;
+        if (eglGetConfigAttrib(display(), config, EGL_NATIVE_VISUAL_ID, &visual) && visual != m_halFormat)
+            return false;
+        return QEglConfigChooser::filterConfig(config);
+    }
+
+private:
+    int m_halFormat;
+};
+
+struct ConfigCacheEntry
+{
+    EGLDisplay display;
+    QSurfaceFormat format;
+    EGLConfig config;
+};
+
+// Searching the configs takes the same time and gives the same result for
+// every window and context of a format, so it is only done once
+static QMutex configCacheMutex;
+static QVector<ConfigCacheEntry> configCache;
+
+// Only what the config search looks at
+static QSurfaceFormat configCacheKey(const QSurfaceFormat &format)
+{
+    QSurfaceFormat key;
+    key.setRedBufferSize(format.redBufferSize());
+    key.setGreenBufferSize(format.greenBufferSize());
+    key.setBlueBufferSize(format.blueBufferSize());
+    key.setAlphaBufferSize(format.alphaBufferSize());
+    key.setDepthBufferSize(format.depthBufferSize());
+    key.setStencilBufferSize(format.stencilBufferSize());
+    key.setSamples(format.samples());
+    key.setRenderableType(format.renderableType());
+    key.setMajorVersion(format.majorVersion());
+    return key;
+}
+
 EGLConfig QEglFSIntegration::chooseConfig(EGLDisplay display, const QSurfaceFormat &format)
 {
-    QEglConfigChooser chooser(display);
+    const QSurfaceFormat key = configCacheKey(format);
+
+    QMutexLocker lock(&configCacheMutex);
+    for (int i = 0; i < configCache.size(); ++i) {
+        const ConfigCacheEntry &entry = configCache.at(i);
+        if (entry.display == display && entry.format == key)
+            return entry.config;
+    }
+
+    HwcConfigChooser chooser(display, HwComposerContext::halFormatFor(format));
     chooser.setSurfaceFormat(format);
-    return chooser.chooseConfig();
+
+    ConfigCacheEntry entry;
+    entry.display = display;
+    entry.format = key;
+    entry.config = chooser.chooseConfig();
+    configCache.append(entry);
+    return entry.config;
+}
+
+void QEglFSIntegration::clearConfigCache(EGLDisplay display)
+{
+    QMutexLocker lock(&configCacheMutex);
+    for (int i = configCache.size() - 1; i >= 0; --i) {
+        if (configCache.at(i).display == display)
+            configCache.remove(i);
+    }
 }
 
 QStringList QEglFSIntegration::themeNames() const
@@ -50,9 +50,12 @@
 #include <qpa/qplatformnativeinterface.h>
 #include <qpa/qplatformscreen.h>
 
+#include <QtCore/QMap>
+
 QT_BEGIN_NAMESPACE
 
-class QEglFSIntegration : public QPlatformIntegration, public QPlatformNativeInterface
+class QEglFSIntegration : public QPlatformIntegration, public QPlatformNativeInterface,
+                          public HwComposerDisplayListener
 {
 public:
     QEglFSIntegration();
@@ -78,11 +81,15 @@ public:
 
     // QPlatformNativeInterface
     void *nativeResourceForIntegration(const QByteArray &resource);
+    void *nativeResourceForScreen(const QByteArray &resource, QScreen *screen) Q_DECL_OVERRIDE;
     void *nativeResourceForWindow(const QByteArray &resource, QWindow *window) Q_DECL_OVERRIDE;
     void *nativeResourceForContext(const QByteArray &resource, QOpenGLContext *context);
+    NativeResourceForIntegrationFunction nativeResourceFunctionForIntegration(const QByteArray &resource) Q_DECL_OVERRIDE;
 
     QPlatformScreen *screen() const { return mScreen; }
+    // Memoized per display and format
     static EGLConfig chooseConfig(EGLDisplay display, const QSurfaceFormat &format);
+    static void clearConfigCache(EGLDisplay display);
 
     EGLDisplay display() const { return mDisplay; }
 
@@ -92,12 +99,24 @@ public:
 
     QPlatformTheme *createPlatformTheme(const QString &name) const;
 
+    HwComposerContext *hwc() const { return mHwc; }
+
+    // HwComposerDisplayListener, displays other than the primary one get
+    // a screen while they are connected
+    void displayConnected(int display) Q_DECL_OVERRIDE;
+    void displayDisconnected(int display) Q_DECL_OVERRIDE;
+
 private:
+    void addScreen(QPlatformScreen *screen);
+    void removeScreen(QPlatformScreen *screen);
+
     HwComposerContext *mHwc;
     EGLDisplay mDisplay;
     QAbstractEventDispatcher *mEventDispatcher;
     QPlatformFontDatabase *mFontDb;
     QPlatformScreen *mScreen;
+    // By HWC_DISPLAY_*
+    QMap<int, QPlatformScreen *> mExternalScreens;
     QPlatformInputContext *mInputContext;
 };
 
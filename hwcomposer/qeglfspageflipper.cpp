@@ -40,50 +40,120 @@
  * ****************************************************************************/
 
 #include "qeglfspageflipper.h"
+#include "hwcomposer_context.h"
 
-#include <qpa/qplatformscreen.h>
+#include <QtCore/QSocketNotifier>
 
-
-#include <sys/mman.h>
-#include <memory.h>
-#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
-#include <stdio.h>
 
 QT_BEGIN_NAMESPACE
 
-QEglFSPageFlipper::QEglFSPageFlipper(QPlatformScreen *screen)
-    : m_screen(screen), m_buffer(0), m_active(false)
+QEglFSPageFlipper::QEglFSPageFlipper(HwComposerContext *hwc)
+    : m_hwc(hwc)
+    , m_buffer(0)
+    , m_pending(0)
+    , m_fenceNotifier(0)
+    , m_fenceFd(-1)
+    , m_active(false)
 {
 }
 
 QEglFSPageFlipper::~QEglFSPageFlipper()
 {
+    if (m_active)
+        setDirectRenderingActive(false);
+
+    // No event loop to wait for the last fence on
+    if (m_fenceFd != -1) {
+        struct pollfd pfd = { m_fenceFd, POLLIN, 0 };
+        poll(&pfd, 1, 1000);
+        flip();
+    }
     if (m_buffer)
         m_buffer->release();
 }
 
 bool QEglFSPageFlipper::displayBuffer(QPlatformScreenBuffer *buffer)
 {
-    // TODO: Implement support for flipping the buffer to screen
-    qWarning("QEglFSPageFlipper::displayBuffer unimplemented in hwcomposer");
-    buffer->displayed();
+    // The previous buffer is not on screen yet, the compositor has to wait
+    // for bufferDisplayed() before handing over another one
+    if (m_fenceFd != -1)
+        return false;
 
+    int fenceFd = -1;
+    if (!m_hwc->scanoutBuffer(buffer->handle(), &fenceFd))
+        return false;
 
-    if (m_buffer)
-        m_buffer->release();
-    m_buffer = buffer;
-
+    m_active = true;
+    m_pending = buffer;
+    watchFence(fenceFd);
     return true;
 }
 
+void QEglFSPageFlipper::watchFence(int fenceFd)
+{
+    m_fenceFd = fenceFd;
+    if (m_fenceFd == -1) {
+        flip();
+        return;
+    }
+
+    // Sync fences become readable once they signal
+    m_fenceNotifier = new QSocketNotifier(m_fenceFd, QSocketNotifier::Read, this);
+    connect(m_fenceNotifier, SIGNAL(activated(int)), this, SLOT(fenceSignaled()));
+}
+
+void QEglFSPageFlipper::fenceSignaled()
+{
+    flip();
+}
+
+void QEglFSPageFlipper::flip()
+{
+    if (m_fenceNotifier) {
+        m_fenceNotifier->setEnabled(false);
+        m_fenceNotifier->deleteLater();
+        m_fenceNotifier = 0;
+    }
+    if (m_fenceFd != -1) {
+        close(m_fenceFd);
+        m_fenceFd = -1;
+    }
+
+    // The display reads from the new buffer now, so the old one is free.
+    // Without a new buffer this was the switch back to the GL composition.
+    QPlatformScreenBuffer *previous = m_buffer;
+    m_buffer = m_pending;
+    m_pending = 0;
+
+    if (m_buffer) {
+        m_buffer->displayed();
+        emit bufferDisplayed(m_buffer);
+    }
+    if (previous) {
+        previous->release();
+        emit bufferReleased(previous);
+    }
+}
+
 void QEglFSPageFlipper::setDirectRenderingActive(bool active)
 {
-    m_active = active;
-    if (!active && m_buffer) {
-        m_buffer->release();
-        m_buffer = 0;
+    if (active || !m_active)
+        return;
+
+    m_active = false;
+
+    // Let a buffer that is on its way to the screen get there first, so
+    // that there is only one left to release
+    if (m_fenceFd != -1) {
+        struct pollfd pfd = { m_fenceFd, POLLIN, 0 };
+        poll(&pfd, 1, 1000);
+        flip();
     }
+
+    int fenceFd = m_hwc->endScanout();
+    watchFence(fenceFd);
 }
 
 QT_END_NAMESPACE
@@ -46,25 +46,36 @@
 
 QT_BEGIN_NAMESPACE
 
-class QPlatformScreen;
+class QSocketNotifier;
+class HwComposerContext;
 
 class QEglFSPageFlipper : public QPlatformScreenPageFlipper
 {
   Q_OBJECT
 
 public:
-    QEglFSPageFlipper(QPlatformScreen *screen);
+    QEglFSPageFlipper(HwComposerContext *hwc);
     ~QEglFSPageFlipper();
 
     bool displayBuffer(QPlatformScreenBuffer *buffer);
 
     bool isActive() const { return m_active; }
 
+private Q_SLOTS:
+    void fenceSignaled();
+
 private:
     Q_INVOKABLE void setDirectRenderingActive(bool active);
 
-    QPlatformScreen *m_screen;
+    void watchFence(int fenceFd);
+    void flip();
+
+    HwComposerContext *m_hwc;
+    // On screen, or about to replace m_buffer once the fence signals
     QPlatformScreenBuffer *m_buffer;
+    QPlatformScreenBuffer *m_pending;
+    QSocketNotifier *m_fenceNotifier;
+    int m_fenceFd;
     bool m_active;
 };
 
@@ -0,0 +1,129 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qeglfsrenderthread.h"
+
+QT_BEGIN_NAMESPACE
+
+class QEglFSRenderThread::FenceJob : public QEglFSRenderThread::Job
+{
+public:
+    FenceJob(QMutex *mutex, QWaitCondition *cond, bool *passed)
+        : m_mutex(mutex), m_cond(cond), m_passed(passed) {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        QMutexLocker lock(m_mutex);
+        *m_passed = true;
+        m_cond->wakeAll();
+    }
+
+private:
+    QMutex *m_mutex;
+    QWaitCondition *m_cond;
+    bool *m_passed;
+};
+
+QEglFSRenderThread::QEglFSRenderThread()
+    : m_quit(false)
+{
+    setObjectName(QStringLiteral("QPA-HWC render"));
+}
+
+QEglFSRenderThread::~QEglFSRenderThread()
+{
+    stop();
+}
+
+void QEglFSRenderThread::post(Job *job)
+{
+    QMutexLocker lock(&m_mutex);
+    m_jobs.enqueue(job);
+    m_cond.wakeAll();
+
+    if (!isRunning()) {
+        m_quit = false;
+        start();
+    }
+}
+
+void QEglFSRenderThread::sync()
+{
+    if (QThread::currentThread() == this)
+        return;
+
+    QMutexLocker lock(&m_mutex);
+    if (!isRunning() || m_quit)
+        return;
+
+    // Jobs run in order, once the fence has the earlier ones have too
+    bool passed = false;
+    m_jobs.enqueue(new FenceJob(&m_mutex, &m_cond, &passed));
+    m_cond.wakeAll();
+    while (!passed)
+        m_cond.wait(&m_mutex);
+}
+
+void QEglFSRenderThread::stop()
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        m_quit = true;
+        m_cond.wakeAll();
+    }
+    wait();
+}
+
+void QEglFSRenderThread::run()
+{
+    QMutexLocker lock(&m_mutex);
+    for (;;) {
+        while (m_jobs.isEmpty() && !m_quit)
+            m_cond.wait(&m_mutex);
+        if (m_jobs.isEmpty())
+            break;
+
+        Job *job = m_jobs.dequeue();
+        lock.unlock();
+        job->run();
+        delete job;
+        lock.relock();
+    }
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,91 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QEGLFSRENDERTHREAD_H
+#define QEGLFSRENDERTHREAD_H
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QQueue>
+
+QT_BEGIN_NAMESPACE
+
+// Runs the GL work of the backing stores of a screen away from the GUI
+// thread, one job after the other in the order they were posted. The
+// contexts of the backing stores live on this thread.
+class QEglFSRenderThread : public QThread
+{
+public:
+    class Job {
+    public:
+        virtual ~Job() {}
+
+        // Called on the render thread, the job is deleted afterwards
+        virtual void run() = 0;
+    };
+
+    QEglFSRenderThread();
+    ~QEglFSRenderThread();
+
+    // Takes ownership of job, starts the thread on first use
+    void post(Job *job);
+
+    // Waits for the jobs posted so far to have run, so that what they
+    // draw to can be released. Returns at once if the thread is not running
+    // or when called from the render thread itself.
+    void sync();
+
+    // Runs the jobs still queued, then ends the thread
+    void stop();
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    class FenceJob;
+
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    QQueue<Job *> m_jobs;
+    bool m_quit;
+};
+
+QT_END_NAMESPACE
+
+#endif // QEGLFSRENDERTHREAD_H
@@ -41,6 +41,10 @@
 
 #include "qeglfsscreen.h"
 #include "qeglfswindow.h"
+#include "qeglfsblitter.h"
+#ifdef HWC_PLUGIN_HAVE_PAGE_FLIPPER
+#include "qeglfspageflipper.h"
+#endif
 
 #include <private/qmath_p.h>
 
@@ -56,9 +60,12 @@
 
 QT_BEGIN_NAMESPACE
 
-QEglFSScreen::QEglFSScreen(HwComposerContext *hwc, EGLDisplay dpy)
+QEglFSScreen::QEglFSScreen(HwComposerContext *hwc, EGLDisplay dpy, int hwcDisplay)
     : m_hwc(hwc)
+    , m_pageFlipper(NULL)
+    , m_blitter(NULL)
     , m_dpy(dpy)
+    , m_hwcDisplay(hwcDisplay)
 #ifdef WITH_SENSORS
     , m_screenOrientation(Qt::PrimaryOrientation)
     , m_orientationSensor(new QOrientationSensor(this))
@@ -67,10 +74,20 @@ QEglFSScreen::QEglFSScreen(HwComposerContext *hwc, EGLDisplay dpy)
 #ifdef QEGL_EXTRA_DEBUG
     qWarning("QEglScreen %p\n", this);
 #endif
+
+#ifdef HWC_PLUGIN_HAVE_PAGE_FLIPPER
+    m_pageFlipper = new QEglFSPageFlipper(m_hwc);
+#endif
 }
 
 QEglFSScreen::~QEglFSScreen()
 {
+    delete m_blitter;
+
+#ifdef HWC_PLUGIN_HAVE_PAGE_FLIPPER
+    delete m_pageFlipper;
+#endif
+
 #ifdef WITH_SENSORS
     if (m_orientationSensor) {
         m_orientationSensor->stop();
@@ -90,7 +107,8 @@ void QEglFSScreen::onStarted()
 
 QRect QEglFSScreen::geometry() const
 {
-    return QRect(QPoint(0, 0), m_hwc->screenSize());
+    // Screens are not virtual siblings, each one starts at the origin
+    return QRect(QPoint(0, 0), m_hwc->displaySize(m_hwcDisplay));
 }
 
 int QEglFSScreen::depth() const
@@ -110,13 +128,13 @@ QImage::Format QEglFSScreen::format() const
 
 QSizeF QEglFSScreen::physicalSize() const
 {
-    return m_hwc->physicalScreenSize();
+    return m_hwc->physicalDisplaySize(m_hwcDisplay);
 }
 
 QDpi QEglFSScreen::logicalDpi() const
 {
-    QSizeF ps = m_hwc->physicalScreenSize();
-    QSize s = m_hwc->screenSize();
+    QSizeF ps = m_hwc->physicalDisplaySize(m_hwcDisplay);
+    QSize s = m_hwc->displaySize(m_hwcDisplay);
 
     return QDpi(Q_MM_PER_INCH * s.width() / ps.width(),
                 Q_MM_PER_INCH * s.height() / ps.height());
@@ -125,9 +143,30 @@ QDpi QEglFSScreen::logicalDpi() const
 
 qreal QEglFSScreen::refreshRate() const
 {
-    return m_hwc->refreshRate();
+    return m_hwc->displayRefreshRate(m_hwcDisplay);
+}
+
+QEglFSBlitter *QEglFSScreen::blitter() const
+{
+    // Only windows with a backing store need it
+    if (!m_blitter)
+        m_blitter = new QEglFSBlitter;
+    return m_blitter;
+}
+
+void QEglFSScreen::waitForRender() const
+{
+    if (m_blitter)
+        m_blitter->renderThread()->sync();
 }
 
+#ifdef HWC_PLUGIN_HAVE_PAGE_FLIPPER
+QPlatformScreenPageFlipper *QEglFSScreen::pageFlipper() const
+{
+    return m_pageFlipper;
+}
+#endif
+
 #ifdef WITH_SENSORS
 void QEglFSScreen::orientationReadingChanged()
 {
@@ -56,6 +56,7 @@ class QOrientationSensor;
 QT_BEGIN_NAMESPACE
 
 class QEglFSPageFlipper;
+class QEglFSBlitter;
 class QPlatformOpenGLContext;
 
 #ifdef WITH_SENSORS
@@ -67,7 +68,8 @@ class QEglFSScreen : public QPlatformScreen //huh: FullScreenScreen ;) just to f
 {
 #endif
 public:
-    QEglFSScreen(HwComposerContext *hwc, EGLDisplay display);
+    // hwcDisplay is the HWC_DISPLAY_* shown by the screen
+    QEglFSScreen(HwComposerContext *hwc, EGLDisplay display, int hwcDisplay = 0);
     ~QEglFSScreen();
 
     QRect geometry() const;
@@ -78,21 +80,31 @@ public:
     QDpi logicalDpi() const;
 
     EGLDisplay display() const { return m_dpy; }
+    int hwcDisplay() const { return m_hwcDisplay; }
 
     qreal refreshRate() const;
 
+    // Shared by the backing stores on this screen
+    QEglFSBlitter *blitter() const;
+
+    // Waits for what the backing stores have posted to the render thread
+    // to be drawn, before a window surface goes away
+    void waitForRender() const;
+
 #ifdef WITH_SENSORS
     Qt::ScreenOrientation orientation() const;
 #endif
 
-#if 0
+#ifdef HWC_PLUGIN_HAVE_PAGE_FLIPPER
     QPlatformScreenPageFlipper *pageFlipper() const;
 #endif
 
 private:
     HwComposerContext *m_hwc;
     QEglFSPageFlipper *m_pageFlipper;
+    mutable QEglFSBlitter *m_blitter;
     EGLDisplay m_dpy;
+    int m_hwcDisplay;
 #ifdef WITH_SENSORS
     Qt::ScreenOrientation m_screenOrientation;
     QOrientationSensor *m_orientationSensor;
@@ -0,0 +1,202 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qeglfstextureuploader.h"
+#include "qeglfsuploadplanner.h"
+
+#include <QtGui/QOpenGLContext>
+#include <QtCore/QElapsedTimer>
+
+#include <string.h>
+
+#ifndef GL_UNPACK_ROW_LENGTH
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#endif
+
+QT_BEGIN_NAMESPACE
+
+QEglFSTextureUploader::QEglFSTextureUploader()
+    : m_planner(QEglFSUploadPlanner::create())
+    , m_current(0)
+    , m_format(GL_RGBA)
+    , m_type(GL_UNSIGNED_BYTE)
+    , m_bytesPerPixel(4)
+    , m_rowLength(false)
+{
+    for (int i = 0; i < TextureCount; ++i)
+        m_textures[i] = 0;
+}
+
+QEglFSTextureUploader::~QEglFSTextureUploader()
+{
+    delete m_planner;
+}
+
+void QEglFSTextureUploader::resize(const QSize &size, GLenum format, GLenum type, int bytesPerPixel)
+{
+    m_format = format;
+    m_type = type;
+    m_bytesPerPixel = bytesPerPixel;
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    m_rowLength = context->format().majorVersion() >= 3
+        || context->hasExtension(QByteArrayLiteral("GL_EXT_unpack_subimage"));
+
+    TextureKey key;
+    key.size = size;
+    key.format = format;
+    key.type = type;
+
+    if (m_textures[0] && !(key == m_key)) {
+        Textures current, evicted;
+        memcpy(current.ids, m_textures, sizeof(m_textures));
+        if (m_pool.put(m_key, current, &evicted))
+            glDeleteTextures(TextureCount, evicted.ids);
+        m_textures[0] = 0;
+    }
+
+    Textures textures;
+    if (m_textures[0]) {
+        // Same textures, the content is stale all the same
+    } else if (m_pool.take(key, &textures)) {
+        memcpy(m_textures, textures.ids, sizeof(m_textures));
+    } else {
+        glGenTextures(TextureCount, m_textures);
+
+        for (int i = 0; i < TextureCount; ++i) {
+            glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, size.width(), size.height(), 0, format, type, 0);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    for (int i = 0; i < TextureCount; ++i)
+        m_pending[i].resize(size);
+
+    m_key = key;
+    m_size = size;
+    m_current = 0;
+}
+
+void QEglFSTextureUploader::destroy()
+{
+    if (m_textures[0])
+        glDeleteTextures(TextureCount, m_textures);
+    for (int i = 0; i < TextureCount; ++i)
+        m_textures[i] = 0;
+    m_size = QSize();
+
+    releasePool();
+}
+
+void QEglFSTextureUploader::releasePool()
+{
+    foreach (const Textures &textures, m_pool.takeAll())
+        glDeleteTextures(TextureCount, textures.ids);
+}
+
+void QEglFSTextureUploader::markDirty(const QRegion &region)
+{
+    for (int i = 0; i < TextureCount; ++i)
+        m_pending[i].markDirty(region);
+}
+
+GLuint QEglFSTextureUploader::upload(const QImage &image)
+{
+    m_current = (m_current + 1) % TextureCount;
+    const QVector<QRect> rects = m_planner->plan(m_pending[m_current].dirtyRects(), m_size, m_bytesPerPixel);
+    m_pending[m_current].clear();
+
+    glBindTexture(GL_TEXTURE_2D, m_textures[m_current]);
+
+    if (m_rowLength) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, image.bytesPerLine() / m_bytesPerPixel);
+        foreach (const QRect &rect, rects) {
+            QElapsedTimer timer;
+            timer.start();
+            glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(), rect.width(), rect.height(),
+                            m_format, m_type, image.constScanLine(rect.y()) + rect.x() * m_bytesPerPixel);
+            m_planner->uploaded(rect.width() * rect.height() * m_bytesPerPixel, timer.nsecsElapsed());
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    } else {
+        foreach (const QRect &rect, rects) {
+            QElapsedTimer timer;
+            timer.start();
+            uploadRect(image, rect);
+            m_planner->uploaded(rect.width() * rect.height() * m_bytesPerPixel, timer.nsecsElapsed());
+        }
+    }
+
+    return m_textures[m_current];
+}
+
+void QEglFSTextureUploader::uploadRect(const QImage &image, const QRect &rect)
+{
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(), rect.width(), rect.height(),
+                    m_format, m_type, unpackRect(image, rect, m_bytesPerPixel, &m_staging));
+}
+
+const uchar *QEglFSTextureUploader::unpackRect(const QImage &image, const QRect &rect, int bytesPerPixel,
+                                               QByteArray *staging)
+{
+    // if the sub-rect is full-width we can pass the image data directly to
+    // OpenGL instead of copying, since there's no gap between scanlines
+    if (rect.width() == image.width())
+        return image.constScanLine(rect.y());
+
+    // Rows stay aligned to the default GL_UNPACK_ALIGNMENT of 4
+    const int rowBytes = rect.width() * bytesPerPixel;
+    const int stride = (rowBytes + 3) & ~3;
+    const int size = stride * rect.height();
+    if (staging->size() < size)
+        staging->resize(size);
+
+    char *dst = staging->data();
+    for (int y = rect.top(); y <= rect.bottom(); ++y, dst += stride)
+        memcpy(dst, image.constScanLine(y) + rect.x() * bytesPerPixel, rowBytes);
+
+    return reinterpret_cast<const uchar *>(staging->constData());
+}
+
+QT_END_NAMESPACE
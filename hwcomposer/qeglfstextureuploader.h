@@ -0,0 +1,130 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QEGLFSTEXTUREUPLOADER_H
+#define QEGLFSTEXTUREUPLOADER_H
+
+#include <QtGui/qopengl.h>
+#include <QtGui/QImage>
+#include <QtGui/QRegion>
+#include <QtCore/QByteArray>
+
+#include "qeglfstilemap.h"
+#include "qeglfsbufferpool.h"
+
+QT_BEGIN_NAMESPACE
+
+class QEglFSUploadPlanner;
+
+// Keeps a texture in sync with a raster image, uploading only the tiles
+// that changed, grouped as the upload planner decides. Two textures are
+// used in turn so that an upload never has to wait for the draw of the
+// previous frame to finish reading from its texture. All calls need the
+// owning context to be current.
+class QEglFSTextureUploader
+{
+public:
+    QEglFSTextureUploader();
+    ~QEglFSTextureUploader();
+
+    // Switches to textures for images uploaded as format and type, their
+    // content is undefined until uploaded. The previous textures are kept
+    // for a while in case the size comes back.
+    void resize(const QSize &size, GLenum format, GLenum type, int bytesPerPixel);
+
+    // Deletes all textures, the context may be shared with others that stay
+    void destroy();
+
+    // Deletes the textures kept for other sizes
+    void releasePool();
+
+    // Parts of the image that changed since the last upload
+    void markDirty(const QRegion &region);
+
+    // Brings the next texture up to date with image and leaves it bound
+    GLuint upload(const QImage &image);
+
+    // The pixels of rect in image as glTexSubImage2D takes them without
+    // GL_UNPACK_ROW_LENGTH, copied into staging unless rect is full width
+    static const uchar *unpackRect(const QImage &image, const QRect &rect, int bytesPerPixel,
+                                   QByteArray *staging);
+
+private:
+    enum {
+        TextureCount = 2,
+        // The textures of the size used before, like the other orientation
+        PoolCapacity = 1
+    };
+
+    struct TextureKey {
+        QSize size;
+        GLenum format;
+        GLenum type;
+
+        bool operator==(const TextureKey &other) const
+        { return size == other.size && format == other.format && type == other.type; }
+    };
+
+    struct Textures {
+        GLuint ids[TextureCount];
+    };
+
+    void uploadRect(const QImage &image, const QRect &rect);
+
+    QEglFSUploadPlanner *m_planner;
+    QEglFSBufferPool<TextureKey, Textures, PoolCapacity> m_pool;
+
+    GLuint m_textures[TextureCount];
+    TextureKey m_key;
+    // What each texture misses compared to the image
+    QEglFSTileMap m_pending[TextureCount];
+    int m_current;
+    QSize m_size;
+    GLenum m_format;
+    GLenum m_type;
+    int m_bytesPerPixel;
+    // GL_UNPACK_ROW_LENGTH lets strided sub-rectangles upload in place
+    bool m_rowLength;
+    // Reused for the rows of sub-rectangles otherwise
+    QByteArray m_staging;
+};
+
+QT_END_NAMESPACE
+
+#endif // QEGLFSTEXTUREUPLOADER_H
@@ -0,0 +1,141 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qeglfstilemap.h"
+
+QT_BEGIN_NAMESPACE
+
+QEglFSTileMap::QEglFSTileMap()
+    : m_columns(0)
+    , m_rows(0)
+    , m_dirtyCount(0)
+{
+}
+
+void QEglFSTileMap::resize(const QSize &size)
+{
+    m_size = size;
+    m_columns = (size.width() + TileSize - 1) / TileSize;
+    m_rows = (size.height() + TileSize - 1) / TileSize;
+    m_tiles = QBitArray(m_columns * m_rows);
+    markAllDirty();
+}
+
+void QEglFSTileMap::markDirty(const QRect &rect)
+{
+    const QRect r = rect & QRect(QPoint(), m_size);
+    if (r.isEmpty())
+        return;
+
+    for (int row = r.top() / TileSize; row <= r.bottom() / TileSize; ++row) {
+        for (int column = r.left() / TileSize; column <= r.right() / TileSize; ++column) {
+            const int i = row * m_columns + column;
+            if (!m_tiles.testBit(i)) {
+                m_tiles.setBit(i);
+                ++m_dirtyCount;
+            }
+        }
+    }
+}
+
+void QEglFSTileMap::markDirty(const QRegion &region)
+{
+    foreach (const QRect &rect, region.rects())
+        markDirty(rect);
+}
+
+void QEglFSTileMap::markAllDirty()
+{
+    m_tiles.fill(true);
+    m_dirtyCount = m_tiles.size();
+}
+
+void QEglFSTileMap::clear()
+{
+    m_tiles.fill(false);
+    m_dirtyCount = 0;
+}
+
+QVector<QRect> QEglFSTileMap::dirtyRects() const
+{
+    QVector<QRect> rects;
+    if (isEmpty())
+        return rects;
+
+    // Rectangles, in tiles, that the previous row may still extend
+    QVector<QRect> open;
+    QVector<QRect> next;
+
+    for (int row = 0; row <= m_rows; ++row) {
+        next.clear();
+
+        int column = 0;
+        while (row < m_rows && column < m_columns) {
+            if (!m_tiles.testBit(row * m_columns + column)) {
+                ++column;
+                continue;
+            }
+
+            const int start = column;
+            while (column < m_columns && m_tiles.testBit(row * m_columns + column))
+                ++column;
+
+            QRect run(start, row, column - start, 1);
+            for (int i = 0; i < open.size(); ++i) {
+                if (open.at(i).left() == run.left() && open.at(i).width() == run.width()) {
+                    run.setTop(open.at(i).top());
+                    open.remove(i);
+                    break;
+                }
+            }
+            next.append(run);
+        }
+
+        // Whatever was not continued is complete
+        foreach (const QRect &tiles, open) {
+            rects.append(QRect(tiles.x() * TileSize, tiles.y() * TileSize,
+                               tiles.width() * TileSize, tiles.height() * TileSize) & QRect(QPoint(), m_size));
+        }
+        open = next;
+    }
+
+    return rects;
+}
+
+QT_END_NAMESPACE
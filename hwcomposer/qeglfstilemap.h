@@ -0,0 +1,85 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QEGLFSTILEMAP_H
+#define QEGLFSTILEMAP_H
+
+#include <QtCore/QBitArray>
+#include <QtCore/QRect>
+#include <QtCore/QVector>
+#include <QtGui/QRegion>
+
+QT_BEGIN_NAMESPACE
+
+// Which fixed size tiles of an image are dirty. Marking is cheap however
+// scattered the updates are, and the dirty tiles come back as few large
+// rectangles, so that uploading them costs about the same per tile.
+class QEglFSTileMap
+{
+public:
+    enum { TileSize = 64 };
+
+    QEglFSTileMap();
+
+    // Everything is dirty after a resize
+    void resize(const QSize &size);
+
+    void markDirty(const QRect &rect);
+    void markDirty(const QRegion &region);
+    void markAllDirty();
+    void clear();
+
+    bool isEmpty() const { return m_dirtyCount == 0; }
+    int dirtyCount() const { return m_dirtyCount; }
+
+    // Runs of dirty tiles along rows, joined with the runs of the rows
+    // below while they span the same columns, clipped to the image
+    QVector<QRect> dirtyRects() const;
+
+private:
+    QSize m_size;
+    int m_columns;
+    int m_rows;
+    QBitArray m_tiles;
+    int m_dirtyCount;
+};
+
+QT_END_NAMESPACE
+
+#endif // QEGLFSTILEMAP_H
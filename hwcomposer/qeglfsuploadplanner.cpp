@@ -0,0 +1,220 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qeglfsuploadplanner.h"
+
+#include <QtCore/QByteArray>
+
+#include <algorithm>
+
+QT_BEGIN_NAMESPACE
+
+class TileUploadPlanner : public QEglFSUploadPlanner
+{
+public:
+    QVector<QRect> plan(const QVector<QRect> &dirty, const QSize &size, int bytesPerPixel) Q_DECL_OVERRIDE
+    {
+        Q_UNUSED(size);
+        Q_UNUSED(bytesPerPixel);
+        return dirty;
+    }
+};
+
+class FullUploadPlanner : public QEglFSUploadPlanner
+{
+public:
+    QVector<QRect> plan(const QVector<QRect> &dirty, const QSize &size, int bytesPerPixel) Q_DECL_OVERRIDE
+    {
+        Q_UNUSED(bytesPerPixel);
+        QVector<QRect> rects;
+        if (!dirty.isEmpty())
+            rects.append(QRect(QPoint(), size));
+        return rects;
+    }
+};
+
+// Models an upload as a fixed overhead per call plus a cost per byte, both
+// fitted by least squares to the uploads seen so far, and merges
+// rectangles for as long as the merged upload is modelled to be cheaper.
+class CostUploadPlanner : public QEglFSUploadPlanner
+{
+public:
+    CostUploadPlanner()
+        // Until calibrated, a call is assumed to cost as much as 16 KiB
+        : m_overheadBytes(16 * 1024)
+        , m_samples(0)
+        , m_sumX(0), m_sumY(0), m_sumXX(0), m_sumXY(0)
+    {
+    }
+
+    QVector<QRect> plan(const QVector<QRect> &dirty, const QSize &size, int bytesPerPixel) Q_DECL_OVERRIDE
+    {
+        QVector<QRect> rects = dirty;
+        const double overhead = m_overheadBytes / bytesPerPixel;
+
+        // Each greedy pass below looks at every pair, scattered updates
+        // are first merged along their rows to keep that affordable
+        if (rects.size() > MaxGreedyRects)
+            mergeBands(rects);
+
+        // Greedily merge the pair that saves the most
+        for (;;) {
+            int bestA = -1;
+            int bestB = -1;
+            double bestSaving = 0;
+            for (int a = 0; a < rects.size(); ++a) {
+                for (int b = a + 1; b < rects.size(); ++b) {
+                    const QRect merged = rects.at(a) | rects.at(b);
+                    const double saving = overhead + area(rects.at(a)) + area(rects.at(b)) - area(merged);
+                    if (saving > bestSaving) {
+                        bestSaving = saving;
+                        bestA = a;
+                        bestB = b;
+                    }
+                }
+            }
+            if (bestA < 0)
+                break;
+
+            // Merging may make the rectangle overlap others, later passes
+            // merge those too as that saves their overhead
+            rects[bestA] |= rects.at(bestB);
+            rects.remove(bestB);
+        }
+
+        double cost = 0;
+        foreach (const QRect &rect, rects)
+            cost += overhead + area(rect);
+        if (rects.size() > 1 && overhead + area(QRect(QPoint(), size)) < cost) {
+            rects.clear();
+            rects.append(QRect(QPoint(), size));
+        }
+
+        return rects;
+    }
+
+    void uploaded(int bytes, qint64 nsecs) Q_DECL_OVERRIDE
+    {
+        if (m_samples >= MaxSamples)
+            return;
+
+        const double x = bytes;
+        const double y = nsecs;
+        ++m_samples;
+        m_sumX += x;
+        m_sumY += y;
+        m_sumXX += x * x;
+        m_sumXY += x * y;
+
+        if (m_samples < MinSamples)
+            return;
+
+        // y = intercept + slope * x, the overhead in bytes is what the
+        // intercept would buy
+        const double n = m_samples;
+        const double variance = n * m_sumXX - m_sumX * m_sumX;
+        if (variance <= 0)
+            return;
+
+        const double slope = (n * m_sumXY - m_sumX * m_sumY) / variance;
+        const double intercept = (m_sumY - slope * m_sumX) / n;
+        if (slope > 0 && intercept > 0)
+            m_overheadBytes = qMin(intercept / slope, double(MaxOverheadBytes));
+    }
+
+private:
+    enum {
+        MinSamples = 64,
+        MaxSamples = 4096,
+        MaxOverheadBytes = 1024 * 1024,
+        MaxGreedyRects = 32
+    };
+
+    static double area(const QRect &rect) { return double(rect.width()) * rect.height(); }
+
+    static bool topLeftLessThan(const QRect &a, const QRect &b)
+    {
+        return a.top() < b.top() || (a.top() == b.top() && a.left() < b.left());
+    }
+
+    // Joins the rectangles of each row band, then neighbouring bands top to
+    // bottom, until at most MaxGreedyRects are left
+    static void mergeBands(QVector<QRect> &rects)
+    {
+        std::sort(rects.begin(), rects.end(), topLeftLessThan);
+
+        int count = 0;
+        for (int i = 0; i < rects.size(); ++i) {
+            if (count > 0 && rects.at(i).top() == rects.at(count - 1).top()
+                    && rects.at(i).bottom() == rects.at(count - 1).bottom())
+                rects[count - 1] |= rects.at(i);
+            else
+                rects[count++] = rects.at(i);
+        }
+        rects.resize(count);
+
+        while (rects.size() > MaxGreedyRects) {
+            count = 0;
+            for (int i = 0; i < rects.size(); i += 2)
+                rects[count++] = i + 1 < rects.size() ? rects.at(i) | rects.at(i + 1) : rects.at(i);
+            rects.resize(count);
+        }
+    }
+
+    double m_overheadBytes;
+    int m_samples;
+    double m_sumX;
+    double m_sumY;
+    double m_sumXX;
+    double m_sumXY;
+};
+
+QEglFSUploadPlanner *QEglFSUploadPlanner::create()
+{
+    const QByteArray planner = qgetenv("QPA_HWC_UPLOAD_PLANNER");
+    if (planner == "tiles")
+        return new TileUploadPlanner;
+    if (planner == "full")
+        return new FullUploadPlanner;
+    if (!planner.isEmpty() && planner != "cost")
+        qWarning("QPA-HWC: unknown upload planner %s, using cost", planner.constData());
+    return new CostUploadPlanner;
+}
+
+QT_END_NAMESPACE
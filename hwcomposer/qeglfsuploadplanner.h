@@ -0,0 +1,72 @@
+/****************************************************************************
+**
+** This file is part of the hwcomposer plugin.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QEGLFSUPLOADPLANNER_H
+#define QEGLFSUPLOADPLANNER_H
+
+#include <QtCore/QRect>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+// Decides how the dirty parts of a backing store go to its texture. Fewer,
+// larger uploads move more bytes, more, smaller ones pay the overhead of
+// a GL call each time. QPA_HWC_UPLOAD_PLANNER picks one of:
+//
+//   cost   merges rectangles while that is cheaper by a cost model that is
+//          calibrated from the uploads themselves (the default)
+//   tiles  uploads the dirty tiles as they are
+//   full   always uploads the whole image
+class QEglFSUploadPlanner
+{
+public:
+    virtual ~QEglFSUploadPlanner() {}
+
+    // Rectangles that cover all of dirty, within an image of size
+    virtual QVector<QRect> plan(const QVector<QRect> &dirty, const QSize &size, int bytesPerPixel) = 0;
+
+    // Called after each upload with what it moved and the time it took
+    virtual void uploaded(int bytes, qint64 nsecs) { Q_UNUSED(bytes); Q_UNUSED(nsecs); }
+
+    static QEglFSUploadPlanner *create();
+};
+
+QT_END_NAMESPACE
+
+#endif // QEGLFSUPLOADPLANNER_H
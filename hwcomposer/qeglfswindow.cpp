@@ -40,6 +40,7 @@
 ****************************************************************************/
 
 #include "qeglfswindow.h"
+#include "qeglfsbackingstore.h"
 #include <qpa/qwindowsysteminterface.h>
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 8, 0))
@@ -57,6 +58,14 @@ QEglFSWindow::QEglFSWindow(HwComposerContext *hwc, QWindow *w)
     , m_surface(0)
     , m_window(0)
     , m_hwc(hwc)
+    , m_display(static_cast<QEglFSScreen *>(screen())->hwcDisplay())
+    , m_layer(false)
+    , m_layerVisible(false)
+    , m_opacity(1.0)
+    , m_raster(false)
+    , m_created(false)
+    , m_reserved(false)
+    , m_backingStore(NULL)
 {
 #ifdef QEGL_EXTRA_DEBUG
     qWarning("QEglWindow %p: %p 0x%x\n", this, w, uint(m_window));
@@ -70,28 +79,54 @@ QEglFSWindow::~QEglFSWindow()
 
 void QEglFSWindow::create()
 {
-    if (m_window)
+    if (m_created)
         return;
+    m_created = true;
 
-    setWindowState(Qt::WindowFullScreen);
+    // Only the first window covers the screen, later ones are placed by
+    // the display hardware where the application puts them
+    m_layer = window()->type() != Qt::Desktop && m_hwc->canCreateLayer(m_display);
+    if (!m_layer && window()->type() != Qt::Desktop) {
+        m_hwc->reserveNativeWindow(m_display);
+        m_reserved = true;
+    }
+    if (!m_layer)
+        setWindowState(Qt::WindowFullScreen);
+    else if (geometry().isEmpty())
+        QPlatformWindow::setGeometry(QRect(QPoint(), m_hwc->displaySize(m_display)));
 
     if (window()->type() == Qt::Desktop) {
-        QRect rect(QPoint(), m_hwc->screenSize());
+        QRect rect(QPoint(), m_hwc->displaySize(m_display));
         QPlatformWindow::setGeometry(rect);
         QWindowSystemInterface::handleGeometryChange(window(), rect);
         return;
     }
 
+    m_raster = window()->surfaceType() == QSurface::RasterSurface && m_hwc->rasterBuffersEnabled();
+    if (m_raster) {
+        m_format = m_hwc->surfaceFormatFor(window()->requestedFormat());
+        return;
+    }
+
     EGLDisplay display = (static_cast<QEglFSScreen *>(window()->screen()->handle()))->display();
     QSurfaceFormat platformFormat = m_hwc->surfaceFormatFor(window()->requestedFormat());
     m_config = QEglFSIntegration::chooseConfig(display, platformFormat);
     m_format = q_glFormatFromConfig(display, m_config);
-    resetSurface();
+}
+
+void QEglFSWindow::ensureNativeWindow()
+{
+    QMutexLocker lock(&m_surfaceMutex);
+    if (!m_window && window()->type() != Qt::Desktop)
+        resetSurface();
 }
 
 void QEglFSWindow::invalidateSurface()
 {
     // Native surface has been deleted behind our backs
+    static_cast<QEglFSScreen *>(screen())->waitForRender();
+
+    QMutexLocker lock(&m_surfaceMutex);
     m_window = 0;
     if (m_surface != 0) {
         EGLDisplay display = (static_cast<QEglFSScreen *>(window()->screen()->handle()))->display();
@@ -104,7 +139,15 @@ void QEglFSWindow::resetSurface()
 {
     EGLDisplay display = static_cast<QEglFSScreen *>(screen())->display();
 
-    m_window = m_hwc->createNativeWindow(m_format);
+    if (m_layer)
+        m_window = m_hwc->createLayerWindow(this);
+    else
+        m_window = m_hwc->createNativeWindow(m_display, m_format);
+
+    // Buffers are dequeued by QEglFSGrallocBackingStore instead
+    if (m_raster)
+        return;
+
     m_surface = eglCreateWindowSurface(display, m_config, m_window, NULL);
     if (m_surface == EGL_NO_SURFACE) {
         EGLint error = eglGetError();
@@ -115,6 +158,13 @@ void QEglFSWindow::resetSurface()
 
 void QEglFSWindow::destroy()
 {
+    // Frames of the backing store may still be drawn to the surface. The
+    // render thread takes the lock on its way there, so wait without it.
+    static_cast<QEglFSScreen *>(screen())->waitForRender();
+
+    m_hwc->forgetWindow(this);
+
+    QMutexLocker lock(&m_surfaceMutex);
     if (m_surface) {
         EGLDisplay display = static_cast<QEglFSScreen *>(screen())->display();
         eglDestroySurface(display, m_surface);
@@ -122,23 +172,92 @@ void QEglFSWindow::destroy()
     }
 
     if (m_window) {
-        m_hwc->destroyNativeWindow(m_window);
+        if (m_layer)
+            m_hwc->destroyLayerWindow(this, m_window);
+        else
+            m_hwc->destroyNativeWindow(m_display, m_window);
         m_window = 0;
     }
+
+    // Windows that were never shown or drawn to have no native window
+    if (m_reserved) {
+        m_hwc->releaseNativeWindow(m_display);
+        m_reserved = false;
+    }
 }
 
-void QEglFSWindow::setGeometry(const QRect &)
+void QEglFSWindow::setGeometry(const QRect &r)
 {
-    // We only support full-screen windows
-    QRect rect(screen()->availableGeometry());
-    QPlatformWindow::setGeometry(rect);
-    QWindowSystemInterface::handleGeometryChange(window(), rect);
-    QWindowSystemInterface::handleExposeEvent(window(), QRegion(rect));
+    if (!m_layer) {
+        // The fullscreen window stays full-screen
+        QRect rect(screen()->availableGeometry());
+        QPlatformWindow::setGeometry(rect);
+        QWindowSystemInterface::handleGeometryChange(window(), rect);
+        QWindowSystemInterface::handleExposeEvent(window(), QRegion(rect));
+        return;
+    }
+
+    const QSize oldSize = geometry().size();
+    QPlatformWindow::setGeometry(r);
+
+    QMutexLocker lock(&m_surfaceMutex);
+    if (m_window) {
+        // Buffers have the size of the layer. The native window and the
+        // EGL surface stay, a render thread may be drawing into them.
+        if (r.size() != oldSize)
+            m_hwc->resizeLayerWindow(this);
+        else
+            m_hwc->updateLayer(this);
+    }
+    lock.unlock();
+
+    QWindowSystemInterface::handleGeometryChange(window(), r);
+    QWindowSystemInterface::handleExposeEvent(window(), QRegion(QRect(QPoint(), r.size())));
+}
+
+void QEglFSWindow::setWindowState(Qt::WindowState state)
+{
+    if (m_layer && state != Qt::WindowFullScreen && state != Qt::WindowMaximized)
+        return;
+
+    setGeometry(screen()->availableGeometry());
+}
+
+void QEglFSWindow::setVisible(bool visible)
+{
+    // Shown windows are drawn to soon, have the buffers ready by then
+    if (visible)
+        ensureNativeWindow();
+
+    if (m_layer) {
+        m_layerVisible = visible;
+        m_hwc->updateLayer(this);
+    }
+
+    // Hidden windows need not come back in another size quickly
+    if (!visible && m_backingStore)
+        m_backingStore->releasePools();
+
+    QPlatformWindow::setVisible(visible);
+}
+
+void QEglFSWindow::setOpacity(qreal level)
+{
+    m_opacity = level;
+    if (m_layer)
+        m_hwc->updateLayer(this);
 }
 
-void QEglFSWindow::setWindowState(Qt::WindowState)
+void QEglFSWindow::raise()
 {
-    setGeometry(QRect());
+    if (m_layer)
+        m_hwc->raiseLayer(this);
+}
+
+void QEglFSWindow::lower()
+{
+    if (m_layer)
+        m_hwc->lowerLayer(this);
 }
 
 WId QEglFSWindow::winId() const
@@ -151,6 +270,13 @@ QSurfaceFormat QEglFSWindow::format() const
     return m_format;
 }
 
+QRegion QEglFSWindow::takeSwapDamage()
+{
+    QRegion damage = m_swapDamage;
+    m_swapDamage = QRegion();
+    return damage;
+}
+
 void QEglFSWindow::requestUpdate()
 {
     if (!m_hwc->requestUpdate(this))
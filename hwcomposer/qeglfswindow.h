@@ -48,9 +48,12 @@
 #include "hwcomposer_context.h"
 
 #include <qpa/qplatformwindow.h>
+#include <QtCore/QMutex>
 
 QT_BEGIN_NAMESPACE
 
+class QEglFSBackingStore;
+
 class QEglFSWindow : public QPlatformWindow
 {
 public:
@@ -59,12 +62,36 @@ public:
 
     void setGeometry(const QRect &);
     void setWindowState(Qt::WindowState state);
+    void setVisible(bool visible);
+    void setOpacity(qreal level);
+    void raise();
+    void lower();
     WId winId() const;
 
+    // Whether the window is a hardware layer above the fullscreen window
+    bool isLayer() const { return m_layer; }
+    bool isLayerVisible() const { return m_layerVisible; }
+    qreal opacity() const { return m_opacity; }
+    // Whether the window has no EGL surface, its buffers are drawn by the CPU
+    bool isRaster() const { return m_raster; }
+    // The HWC_DISPLAY_* of the screen, windows moving to another screen
+    // are recreated
+    int hwcDisplay() const { return m_display; }
+
     EGLSurface surface() const { return m_surface; }
+    EGLNativeWindowType nativeWindow() const { return m_window; }
     QSurfaceFormat format() const;
 
+    // Part of the window the next swap changes, empty if unknown
+    void setSwapDamage(const QRegion &damage) { m_swapDamage = damage; }
+    QRegion takeSwapDamage();
+
+    // Picks the format and place of the window, on the GUI thread when the
+    // platform window is created. The native window with its buffers and
+    // the EGL surface are only allocated by ensureNativeWindow(), once the
+    // window is shown or drawn to, which may be on a render thread.
     void create();
+    void ensureNativeWindow();
     void destroy();
 
     virtual void invalidateSurface();
@@ -72,14 +99,31 @@ public:
 
     void requestUpdate();
 
+    // The GL backing store drawing to the window, told when it is hidden
+    QEglFSBackingStore *backingStore() const { return m_backingStore; }
+    void setBackingStore(QEglFSBackingStore *store) { m_backingStore = store; }
+
 protected:
     EGLSurface m_surface;
     EGLNativeWindowType m_window;
 
 private:
     HwComposerContext *m_hwc;
+    int m_display;
     EGLConfig m_config;
     QSurfaceFormat m_format;
+    bool m_layer;
+    bool m_layerVisible;
+    qreal m_opacity;
+    bool m_raster;
+    bool m_created;
+    // Holds the fullscreen window reservation of its display
+    bool m_reserved;
+    QEglFSBackingStore *m_backingStore;
+    // Guards m_window and m_surface, which render threads allocate on
+    // their first frame while the GUI thread may release them
+    QMutex m_surfaceMutex;
+    QRegion m_swapDamage;
 };
 QT_END_NAMESPACE
 #endif // QEGLFSWINDOW_H
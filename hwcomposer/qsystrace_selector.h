@@ -42,15 +42,59 @@
 #ifdef WITH_SYSTRACE
 #include <private/qsystrace_p.h>
 #else
-// Add dummy stub methods for QSysTrace
+// Same calls as QSysTrace, going to the built-in trace_marker backend
+#include "hwcomposer_trace.h"
+
 namespace QSystrace
 {
-    inline void begin(const char *module, const char *tracepoint, const char *message, ...) {}
-    inline void end(const char *module, const char *tracepoint, const char *message, ...) {}
-    inline void counter(const char *module, const char *tracepoint, const char *message, ...) {}
+    inline void begin(const char *module, const char *tracepoint, const char *message, ...)
+    {
+        Q_UNUSED(module);
+        if (Q_LIKELY(!HwComposerTrace::isEnabled()))
+            return;
+        va_list args;
+        va_start(args, message);
+        HwComposerTrace::begin(tracepoint, message, args);
+        va_end(args);
+    }
+
+    inline void end(const char *module, const char *tracepoint, const char *message, ...)
+    {
+        Q_UNUSED(module); Q_UNUSED(tracepoint); Q_UNUSED(message);
+        if (Q_LIKELY(!HwComposerTrace::isEnabled()))
+            return;
+        HwComposerTrace::end();
+    }
+
+    inline void counter(const char *module, const char *tracepoint, const char *message, ...)
+    {
+        Q_UNUSED(module);
+        if (Q_LIKELY(!HwComposerTrace::isEnabled()))
+            return;
+        va_list args;
+        va_start(args, message);
+        HwComposerTrace::counter(tracepoint, message, args);
+        va_end(args);
+    }
 };
+
 struct QSystraceEvent {
-    QSystraceEvent(const char *module, const char *tracepoint) {}
+    QSystraceEvent(const char *module, const char *tracepoint)
+        : m_begun(HwComposerTrace::isEnabled())
+    {
+        if (Q_UNLIKELY(m_begun))
+            QSystrace::begin(module, tracepoint, "");
+    }
+
+    ~QSystraceEvent()
+    {
+        // Ends what it began even if tracing was switched off meanwhile
+        if (Q_UNLIKELY(m_begun))
+            HwComposerTrace::end();
+    }
+
+private:
+    bool m_begun;
 };
 #endif
 
@@ -0,0 +1,6 @@
+TEMPLATE = subdirs
+
+# Packages build the plugin from hwcomposer/ alone, the benchmarks are for
+# development and are not installed
+SUBDIRS += hwcomposer \
+           benchmarks